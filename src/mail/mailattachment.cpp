@@ -40,29 +40,59 @@
 
 #include "mailattachment.h"
 #include "mailutility_p.h"
-#include <QTextCodec>
 #include <QBuffer>
 #include <QPointer>
 #include <QFile>
+#include <QMutex>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QThread>
 #include <QtDebug>
 
 class QxtMailAttachmentPrivate : public QSharedData
 {
 public:
-    QHash<QString, QString> extraHeaders;
+    QxtMailHeaders extraHeaders;
     QString contentType;
+    // transfer encoding the content is already in, or empty to encode it when rendering
+    QString transferEncoding;
     // those two members are mutable because they may change in the const rawData() method of QxtMailAttachment,
     // while caching the raw data for the attachment if needed.
     mutable QPointer<QIODevice> content;
     mutable bool deleteContent;
+    // when compressed is set, the content device is replaced by its data compressed
+    // with qCompress() in blocks of QXT_ATTACHMENT_CHUNK_SIZE bytes, so that it can
+    // be decompressed and encoded one block at a time. compressedSize is the size of
+    // the uncompressed data, or -1 if the content isn't stored in blocks.
+    bool compressed;
+    mutable QList<QByteArray> blocks;
+    mutable qint64 compressedSize;
+    // statistics of the content, computed by the first mimeData() call and
+    // shared by all the messages the attachment is part of
+    mutable QxtMailContentInfo contentInfo;
+    // SHA-1 of the content, the key of its encoded body in the shared cache
+    mutable QByteArray contentHash;
+    // guards the three caches above, as messages may be rendered in other threads
+    mutable QMutex mutex;
 
     QxtMailAttachmentPrivate()
     {
         content = 0;
         deleteContent = false;
+        compressed = false;
+        compressedSize = -1;
         contentType = QStringLiteral("text/plain");
     }
 
+    QxtMailAttachmentPrivate(const QxtMailAttachmentPrivate& other)
+        : QSharedData(other), extraHeaders(other.extraHeaders), contentType(other.contentType),
+          transferEncoding(other.transferEncoding),
+          content(other.content), deleteContent(other.deleteContent), compressed(other.compressed),
+          blocks(other.blocks), compressedSize(other.compressedSize), contentInfo(other.contentInfo),
+          contentHash(other.contentHash)
+    {
+    }
+
     ~QxtMailAttachmentPrivate()
     {
         if (deleteContent && content)
@@ -70,7 +100,298 @@ public:
         deleteContent = false;
         content = 0;
     }
+
+    bool cacheContent() const;
+    bool compressContent() const;
+    QByteArray uncompressContent() const;
+    void restoreContent() const;
+};
+
+// Devices that can't be mapped are read in chunks of this size while encoding.
+// It is a multiple of 57 bytes so that each chunk gives whole base64 lines.
+static const qint64 QXT_ATTACHMENT_CHUNK_SIZE = 57 * 1024;
+
+// Reads \a size bytes from \a device into \a data, or less only at the end of the
+// data, and returns the number of bytes read.
+static qint64 qxt_read_block(QIODevice* device, char* data, qint64 size)
+{
+    qint64 filled = 0;
+    while (filled < size)
+    {
+        const qint64 n = device->read(data + filled, size - filled);
+        if (n <= 0)
+            break;
+        filled += n;
+    }
+    return filled;
+}
+
+// Replaces a content device that isn't a QBuffer with a QBuffer holding all its
+// data. Must be called with the mutex locked.
+bool QxtMailAttachmentPrivate::cacheContent() const
+{
+    QIODevice* c = content;
+    if (!c->isOpen() && !c->open(QIODevice::ReadOnly))
+    {
+        qWarning() << "QxtMailAttachment::rawData(): Cannot open content for reading";
+        return false;
+    }
+    QBuffer* cache = new QBuffer();
+    cache->open(QIODevice::WriteOnly);
+    char buf[1024];
+    while (!c->atEnd())
+    {
+        cache->write(buf, c->read(buf, 1024));
+    }
+    // the cache is deleted with deleteLater(), so give it a thread with an event loop
+    cache->moveToThread(c->thread());
+    if (deleteContent && content)
+        content->deleteLater();
+    content = cache;
+    deleteContent = true;
+    return true;
+}
+
+// Moves the content into compressed blocks and drops the content device. The
+// hash of the content is computed on the way. Must be called with the mutex locked.
+bool QxtMailAttachmentPrivate::compressContent() const
+{
+    QIODevice* c = content;
+    if (!c)
+        return false;
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    blocks.clear();
+    compressedSize = 0;
+    if (QBuffer* buffer = qobject_cast<QBuffer*>(c))
+    {
+        const QByteArray& data = buffer->data();
+        for (int pos = 0; pos < data.size(); pos += int(QXT_ATTACHMENT_CHUNK_SIZE))
+        {
+            const int n = qMin(int(QXT_ATTACHMENT_CHUNK_SIZE), data.size() - pos);
+            blocks += qCompress(reinterpret_cast<const uchar*>(data.constData()) + pos, n);
+        }
+        hash.addData(data);
+        compressedSize = data.size();
+    }
+    else
+    {
+        if (!c->isOpen() && !c->open(QIODevice::ReadOnly))
+        {
+            qWarning("QxtMailAttachment::setCompressed(): Cannot open content for reading");
+            compressedSize = -1;
+            return false;
+        }
+        if (!c->isSequential())
+            c->seek(0);
+        QByteArray block(int(QXT_ATTACHMENT_CHUNK_SIZE), Qt::Uninitialized);
+        qint64 n;
+        while ((n = qxt_read_block(c, block.data(), QXT_ATTACHMENT_CHUNK_SIZE)) > 0)
+        {
+            blocks += qCompress(reinterpret_cast<const uchar*>(block.constData()), int(n));
+            hash.addData(block.constData(), int(n));
+            compressedSize += n;
+        }
+    }
+    contentHash = hash.result();
+    if (deleteContent)
+        c->deleteLater();
+    content = 0;
+    deleteContent = false;
+    return true;
+}
+
+// Returns the whole content stored in compressed blocks.
+QByteArray QxtMailAttachmentPrivate::uncompressContent() const
+{
+    QByteArray rv;
+    rv.reserve(int(compressedSize));
+    foreach (const QByteArray& block, blocks)
+        rv += qUncompress(block);
+    return rv;
+}
+
+// Turns the compressed blocks back into a QBuffer content. Must be called with
+// the mutex locked.
+void QxtMailAttachmentPrivate::restoreContent() const
+{
+    QBuffer* buffer = new QBuffer;
+    buffer->setData(uncompressContent());
+    content = buffer;
+    deleteContent = true;
+    blocks.clear();
+    compressedSize = -1;
+}
+
+// Encoded attachment bodies, keyed by the SHA-1 of their content and the
+// transfer encoding, so that the same document attached to many messages is
+// only encoded once.
+class QxtEncodedAttachmentCache
+{
+public:
+    QxtEncodedAttachmentCache() : cache(16 * 1024 * 1024) {}
+
+    bool lookup(const QByteArray& key, QByteArray& buffer)
+    {
+        QMutexLocker locker(&mutex);
+        const QByteArray* encoded = cache.object(key);
+        if (!encoded)
+            return false;
+        buffer += *encoded;
+        return true;
+    }
+
+    // the body is only copied when it fits in the cache
+    void insert(const QByteArray& key, const char* encoded, int size)
+    {
+        QMutexLocker locker(&mutex);
+        if (size <= cache.maxCost())
+            cache.insert(key, new QByteArray(encoded, size), size);
+    }
+
+    int maxCost()
+    {
+        QMutexLocker locker(&mutex);
+        return cache.maxCost();
+    }
+
+    void setMaxCost(int cost)
+    {
+        QMutexLocker locker(&mutex);
+        cache.setMaxCost(cost);
+    }
+
+private:
+    QMutex mutex;
+    QCache<QByteArray, QByteArray> cache;
 };
+Q_GLOBAL_STATIC(QxtEncodedAttachmentCache, qxt_encoded_attachment_cache)
+
+// Returns the smallest size \a size bytes of content can take once encoded.
+// Base64 is exact; 7bit and quoted-printable never drop a byte.
+static qint64 qxt_min_encoded_size(qint64 size, QxtMailTransferEncoding encoding)
+{
+    if (encoding != QxtMailBase64)
+        return size;
+    return (size + 2) / 3 * 4 + 2 * ((size + 56) / 57);
+}
+
+static void qxt_encode_body(QByteArray& rv, const char* data, int size, QxtMailTransferEncoding encoding)
+{
+    if (encoding == QxtMail7Bit)
+        qxt_encode_7bit(rv, data, size);
+    else if (encoding == QxtMailQuotedPrintable)
+        qxt_encode_quoted_printable(rv, data, size);
+    else
+        qxt_encode_base64(rv, data, size);
+}
+
+// Adds the statistics of \a piece, which starts at the beginning of a line, to \a info.
+static void qxt_merge_content_info(QxtMailContentInfo& info, const QxtMailContentInfo& piece)
+{
+    info.size += piece.size;
+    info.eightBit += piece.eightBit;
+    info.control += piece.control;
+    info.qpEscapes += piece.qpEscapes;
+    info.crlf += piece.crlf;
+    info.bareCr += piece.bareCr;
+    info.bareLf += piece.bareLf;
+    info.maxLineLength = qMax(info.maxLineLength, piece.maxLineLength);
+}
+
+// Analyzes and encodes content stored in compressed blocks one block at a time.
+// Text is cut after its last line break and the rest carried into the next
+// block, as the analysis and the text encoders work line by line; base64
+// blocks always hold whole lines.
+static QxtMailContentInfo qxt_analyze_blocks(const QList<QByteArray>& blocks)
+{
+    QxtMailContentInfo info;
+    info.valid = true;
+    QByteArray pending;
+    foreach (const QByteArray& block, blocks)
+    {
+        pending += qUncompress(block);
+        const int cut = pending.lastIndexOf('\n') + 1;
+        qxt_merge_content_info(info, qxt_analyze_content(pending.constData(), cut));
+        pending.remove(0, cut);
+    }
+    qxt_merge_content_info(info, qxt_analyze_content(pending.constData(), pending.size()));
+    return info;
+}
+
+static void qxt_encode_blocks(QByteArray& rv, const QList<QByteArray>& blocks, QxtMailTransferEncoding encoding)
+{
+    QByteArray pending;
+    foreach (const QByteArray& block, blocks)
+    {
+        pending += qUncompress(block);
+        const int cut = encoding == QxtMailBase64 ? pending.size() : pending.lastIndexOf('\n') + 1;
+        if (cut)
+            qxt_encode_body(rv, pending.constData(), cut, encoding);
+        pending.remove(0, cut);
+    }
+    if (!pending.isEmpty())
+        qxt_encode_body(rv, pending.constData(), pending.size(), encoding);
+}
+
+// Appends content that is already transfer-encoded. It is copied verbatim when
+// all its lines end with CRLF and are short enough; otherwise base64 is wrapped
+// again without being decoded, and other encodings get their line breaks fixed.
+static void qxt_append_encoded(QByteArray& rv, const char* data, int size, bool base64)
+{
+    const int limit = base64 ? 76 : 998;
+    bool verbatim = true;
+    bool tooLong = false;
+    int lineStart = 0;
+    for (int i = 0; i < size; i++)
+    {
+        if (data[i] != '\n')
+            continue;
+        const int length = i - lineStart - 1;
+        if (length < 0 || data[i - 1] != '\r' || (!base64 && data[lineStart] == '.'))
+            verbatim = false;
+        if (length > limit)
+        {
+            tooLong = true;
+            verbatim = false;
+        }
+        lineStart = i + 1;
+    }
+    if (lineStart < size)
+    {
+        verbatim = false;
+        tooLong = tooLong || size - lineStart > limit;
+    }
+    if (verbatim)
+    {
+        rv.append(data, size);
+    }
+    else if (base64)
+    {
+        rv.reserve(rv.length() + size + size / 38 + 2);
+        int column = 0;
+        for (int i = 0; i < size; i++)
+        {
+            const char ch = data[i];
+            if (ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t')
+                continue;
+            rv += ch;
+            if (++column == 76)
+            {
+                rv += "\r\n";
+                column = 0;
+            }
+        }
+        if (column)
+            rv += "\r\n";
+    }
+    else
+    {
+        if (tooLong)
+            qWarning("QxtMailAttachment::mimeData(): Encoded content has lines longer than 998 characters");
+        // normalizes the line breaks and stuffs the leading dots
+        qxt_encode_7bit(rv, data, size);
+    }
+}
 
 QxtMailAttachment::QxtMailAttachment()
 {
@@ -117,8 +438,14 @@ void QxtMailAttachment::setContent(const QByteArray& content)
     if (qxt_d->deleteContent && qxt_d->content)
         qxt_d->content->deleteLater();
     qxt_d->content = new QBuffer;
+    qxt_d->contentInfo = QxtMailContentInfo();
+    qxt_d->contentHash.clear();
     setDeleteContent(true);
     static_cast<QBuffer*>(qxt_d->content.data())->setData(content);
+    qxt_d->blocks.clear();
+    qxt_d->compressedSize = -1;
+    if (qxt_d->compressed)
+        qxt_d->compressContent();
 }
 
 void QxtMailAttachment::setContent(QIODevice* content)
@@ -126,6 +453,12 @@ void QxtMailAttachment::setContent(QIODevice* content)
     if (qxt_d->deleteContent && qxt_d->content)
         qxt_d->content->deleteLater();
     qxt_d->content = content;
+    qxt_d->contentInfo = QxtMailContentInfo();
+    qxt_d->contentHash.clear();
+    qxt_d->blocks.clear();
+    qxt_d->compressedSize = -1;
+    if (qxt_d->compressed)
+        qxt_d->compressContent();
 }
 
 bool QxtMailAttachment::deleteContent() const
@@ -150,59 +483,204 @@ void QxtMailAttachment::setContentType(const QString& contentType)
 
 QHash<QString, QString> QxtMailAttachment::extraHeaders() const
 {
-    return qxt_d->extraHeaders;
+    return qxt_d->extraHeaders.toHash();
 }
 
 QString QxtMailAttachment::extraHeader(const QString& key) const
 {
-    return qxt_d->extraHeaders[key.toLower()];
+    return qxt_d->extraHeaders.value(key);
 }
 
 bool QxtMailAttachment::hasExtraHeader(const QString& key) const
 {
-    return qxt_d->extraHeaders.contains(key.toLower());
+    return qxt_d->extraHeaders.contains(key);
 }
 
 void QxtMailAttachment::setExtraHeader(const QString& key, const QString& value)
 {
-    qxt_d->extraHeaders[key.toLower()] = value;
+    qxt_d->extraHeaders.set(key, value);
 }
 
 void QxtMailAttachment::setExtraHeaders(const QHash<QString, QString>& a)
 {
-    QHash<QString, QString>& headers = qxt_d->extraHeaders;
-    headers.clear();
-    foreach(const QString& key, a.keys())
-    {
-        headers[key.toLower()] = a[key];
-    }
+    qxt_d->extraHeaders = QxtMailHeaders::fromHash(a);
 }
 
 void QxtMailAttachment::removeExtraHeader(const QString& key)
 {
-    qxt_d->extraHeaders.remove(key.toLower());
+    qxt_d->extraHeaders.remove(key);
 }
 
 QByteArray QxtMailAttachment::mimeData()
 {
-    QTextCodec* latin1 = QTextCodec::codecForName("latin1");
-    QByteArray rv = "Content-Type: " + qxt_d->contentType.toLatin1() + "\r\nContent-Transfer-Encoding: base64\r\n";
-    foreach(const QString& r, qxt_d->extraHeaders.keys())
+    QByteArray rv;
+    appendMimeData(rv);
+    return rv;
+}
+
+// used by the message renderer to write the part straight into its output.
+// The content is encoded from the memory of a QBuffer or from a QFile mapped
+// with QFile::map(), so that it is never copied into the heap; other devices
+// and compressed content are read in chunks.
+void QxtMailAttachment::appendMimeData(QByteArray& rv) const
+{
+    // only read through constData() so the cached statistics land in the shared data
+    const QxtMailAttachmentPrivate* d = qxt_d.constData();
+    const bool text = isText();
+    const bool encoded = !d->transferEncoding.isEmpty();
+    // the content device is shared by all the copies of the attachment
+    QMutexLocker locker(&d->mutex);
+
+    QIODevice* device = d->content;
+    QFile* file = 0;
+    uchar* mapped = 0;
+    bool opened = false;
+    bool chunked = false;
+    QByteArray read;
+    const char* data = 0;
+    qint64 size = 0;
+    if (d->compressedSize >= 0)
     {
-        rv += qxt_fold_mime_header(r, extraHeader(r), latin1);
+        if (encoded)
+        {
+            // encoded content is checked as a whole before it is written
+            read = d->uncompressContent();
+            data = read.constData();
+            size = read.size();
+        }
+        else
+        {
+            // the blocks are only inflated when the encoded body isn't cached
+            chunked = true;
+            if (text && !d->contentInfo.valid)
+                d->contentInfo = qxt_analyze_blocks(d->blocks);
+        }
+    }
+    else if (!device)
+    {
+        qWarning("QxtMailAttachment::mimeData(): Content not set!");
+    }
+    else
+    {
+        if (device->isSequential() && !qobject_cast<QBuffer*>(device))
+        {
+            // the device can't be read a second time: keep its data
+            if (d->cacheContent())
+                device = d->content;
+        }
+        if (QBuffer* buffer = qobject_cast<QBuffer*>(device))
+        {
+            data = buffer->data().constData();
+            size = buffer->data().size();
+        }
+        else if (device->isOpen() || (opened = device->open(QIODevice::ReadOnly)))
+        {
+            file = qobject_cast<QFile*>(device);
+            size = device->size();
+            if (file && size > 0)
+                mapped = file->map(0, size);
+            if (mapped)
+            {
+                data = reinterpret_cast<const char*>(mapped);
+            }
+            else if (text || encoded)
+            {
+                // text needs to be analyzed before it is encoded, and encoded
+                // content to be checked before it is written
+                device->seek(0);
+                read = device->readAll();
+                data = read.constData();
+                size = read.size();
+            }
+            else
+            {
+                chunked = true;
+            }
+        }
+        else
+        {
+            qWarning("QxtMailAttachment::mimeData(): Cannot open content for reading");
+        }
+    }
+
+    QxtMailTransferEncoding encoding = QxtMailBase64;
+    if (text && !encoded)
+    {
+        if (!d->contentInfo.valid)
+            d->contentInfo = qxt_analyze_content(data, int(size));
+        encoding = qxt_choose_transfer_encoding(d->contentInfo, true);
+    }
+
+    rv += "Content-Type: ";
+    qxt_append_latin1(rv, d->contentType);
+    rv += "\r\nContent-Transfer-Encoding: ";
+    if (encoded)
+        qxt_append_latin1(rv, d->transferEncoding);
+    else
+        rv += qxt_transfer_encoding_name(encoding);
+    rv += "\r\n";
+    const QxtMailHeaders& headers = d->extraHeaders;
+    for (int i = 0; i < headers.count(); i++)
+    {
+        if (headers.id(i) == QxtMailHeaders::ContentType || headers.id(i) == QxtMailHeaders::ContentTransferEncoding)
+            continue; // already written above
+        qxt_fold_mime_header(rv, headers.name(i), headers.value(i));
     }
     rv += "\r\n";
 
-    const QByteArray& d = rawData();
-    for (int pos = 0; pos < d.length(); pos += 57)
+    if (encoded)
     {
-        rv += d.mid(pos, 57).toBase64() + "\r\n";
+        qxt_append_encoded(rv, data, int(size), d->transferEncoding.compare(QLatin1String("base64"), Qt::CaseInsensitive) == 0);
     }
-    return rv;
+    else if (chunked && d->compressedSize < 0)
+    {
+        device->seek(0);
+        QByteArray chunk(int(QXT_ATTACHMENT_CHUNK_SIZE), Qt::Uninitialized);
+        // only the last chunk may be short, or it would end a base64 line early
+        qint64 n;
+        while ((n = qxt_read_block(device, chunk.data(), QXT_ATTACHMENT_CHUNK_SIZE)) > 0)
+            qxt_encode_base64(rv, chunk.constData(), int(n));
+    }
+    else
+    {
+        QxtEncodedAttachmentCache* cache = qxt_encoded_attachment_cache();
+        // a body too large for the cache is neither hashed, looked up nor kept
+        const qint64 contentSize = chunked ? d->compressedSize : size;
+        const bool cacheable = qxt_min_encoded_size(contentSize, encoding) <= cache->maxCost();
+        QByteArray key;
+        if (cacheable)
+        {
+            if (d->contentHash.isEmpty())
+            {
+                QCryptographicHash hash(QCryptographicHash::Sha1);
+                hash.addData(data, int(size));
+                d->contentHash = hash.result();
+            }
+            key = d->contentHash + char('0' + encoding);
+        }
+        if (!cacheable || !cache->lookup(key, rv))
+        {
+            const int start = rv.size();
+            if (chunked)
+                qxt_encode_blocks(rv, d->blocks, encoding);
+            else
+                qxt_encode_body(rv, data, int(size), encoding);
+            if (cacheable)
+                cache->insert(key, rv.constData() + start, rv.size() - start);
+        }
+    }
+
+    if (mapped)
+        file->unmap(mapped);
+    if (opened)
+        device->close();
 }
 
 const QByteArray& QxtMailAttachment::rawData() const
 {
+    QMutexLocker locker(&qxt_d->mutex);
+    if (qxt_d->compressedSize >= 0)
+        qxt_d->restoreContent();
     if (qxt_d->content == 0)
     {
         qWarning("QxtMailAttachment::rawData(): Content not set!");
@@ -214,28 +692,38 @@ const QByteArray& QxtMailAttachment::rawData() const
         // content isn't hold in a buffer but in another kind of QIODevice
         // (probably a QFile...). Read the data and cache it into a buffer
         static QByteArray empty;
-        QIODevice* c = content();
-        if (!c->isOpen() && !c->open(QIODevice::ReadOnly))
-        {
-            qWarning() << "QxtMailAttachment::rawData(): Cannot open content for reading";
+        if (!qxt_d->cacheContent())
             return empty;
-        }
-        QBuffer* cache = new QBuffer();
-        cache->open(QIODevice::WriteOnly);
-        char buf[1024];
-        while (!c->atEnd())
-        {
-            cache->write(buf, c->read(buf, 1024));
-        }
-        if (qxt_d->deleteContent && qxt_d->content)
-        qxt_d->content->deleteLater();
-        qxt_d->content = cache;
-        qxt_d->deleteContent = true;
     }
     return qobject_cast<QBuffer *>(qxt_d->content.data())->data();
 }
 
 
+/*!
+ * Returns the maximum number of bytes of encoded attachment bodies kept in the
+ * process-wide cache.
+ *
+ * \sa setEncodedCacheSize()
+ */
+int QxtMailAttachment::encodedCacheSize()
+{
+    return qxt_encoded_attachment_cache()->maxCost();
+}
+
+/*!
+ * Sets to \a bytes the size of the process-wide cache of encoded attachment
+ * bodies. Attachments with the same content share the entry, so a document sent
+ * with many messages is only encoded once. The default is 16 MB; \c 0 disables
+ * the cache.
+ *
+ * Binary content on a random-access device other than a QBuffer or a QFile is
+ * encoded in chunks and never cached.
+ */
+void QxtMailAttachment::setEncodedCacheSize(int bytes)
+{
+    qxt_encoded_attachment_cache()->setMaxCost(qMax(0, bytes));
+}
+
 // gives only a hint, based on content-type value.
 // return true if the content-type corresponds to textual data (text/*, application/xml...)
 // and false if unsure, so don't interpret a 'false' response as 'it's binary data...
@@ -250,3 +738,68 @@ QxtMailAttachment QxtMailAttachment::fromFile(const QString& filename)
     rv.setDeleteContent(true);
     return rv;
 }
+
+/*!
+ * Returns \c true if the content is kept compressed in memory.
+ *
+ * \sa setCompressed()
+ */
+bool QxtMailAttachment::isCompressed() const
+{
+    return qxt_d->compressed;
+}
+
+/*!
+ * If \a enable is \c true, the content is read at once and kept in memory
+ * compressed with qCompress(), and the content device is released, so
+ * content() returns 0. This suits text attachments waiting in a QxtSmtp queue.
+ * Binary content is decompressed block by block while it is encoded; text
+ * content is decompressed for the time it is encoded.
+ *
+ * Calling rawData() decompresses the content again until the next setContent().
+ */
+void QxtMailAttachment::setCompressed(bool enable)
+{
+    QMutexLocker locker(&qxt_d->mutex);
+    qxt_d->compressed = enable;
+    if (enable && qxt_d->compressedSize < 0)
+        qxt_d->compressContent();
+    else if (!enable && qxt_d->compressedSize >= 0)
+        qxt_d->restoreContent();
+}
+
+/*!
+ * Returns an attachment of type \a contentType whose \a content is already
+ * encoded with \a transferEncoding.
+ *
+ * \sa setTransferEncoding()
+ */
+QxtMailAttachment QxtMailAttachment::fromEncoded(const QByteArray& content, const QString& transferEncoding, const QString& contentType)
+{
+    QxtMailAttachment rv(content, contentType);
+    rv.setTransferEncoding(transferEncoding);
+    return rv;
+}
+
+/*!
+ * Returns the transfer encoding the content is already in, or an empty string if
+ * the content is encoded when the message is rendered.
+ *
+ * \sa setTransferEncoding()
+ */
+QString QxtMailAttachment::transferEncoding() const
+{
+    return qxt_d->transferEncoding;
+}
+
+/*!
+ * Declares that the content is already encoded with \a encoding, such as
+ * \c base64 or \c quoted-printable. The content is then written as it is when the
+ * message is rendered, after a check that its lines end with CRLF and fit in the
+ * limits of the encoding. Base64 content that fails the check is wrapped again
+ * without being decoded. An empty \a encoding makes the content raw data again.
+ */
+void QxtMailAttachment::setTransferEncoding(const QString& encoding)
+{
+    qxt_d->transferEncoding = encoding;
+}
@@ -51,11 +51,19 @@ public:
     QxtMailAttachment& operator=(const QxtMailAttachment& other);
     ~QxtMailAttachment();
     static QxtMailAttachment fromFile(const QString& filename);
+    static QxtMailAttachment fromEncoded(const QByteArray& content, const QString& transferEncoding,
+                                         const QString& contentType = QStringLiteral("application/octet-stream"));
 
     QIODevice* content() const;
     void setContent(const QByteArray& content);
     void setContent(QIODevice* content);
 
+    QString transferEncoding() const;
+    void setTransferEncoding(const QString& encoding);
+
+    bool isCompressed() const;
+    void setCompressed(bool enable);
+
     bool deleteContent() const;
     void setDeleteContent(bool enable);
 
@@ -73,7 +81,14 @@ public:
     const QByteArray& rawData() const;
     bool isText() const;
 
+    static int encodedCacheSize();
+    static void setEncodedCacheSize(int bytes);
+
 private:
+    friend struct QxtMailMessagePrivate;
+    friend class QxtMailMimePartPrivate;
+    void appendMimeData(QByteArray& buffer) const;
+
     QSharedDataPointer<QxtMailAttachmentPrivate> qxt_d;
 };
 Q_DECLARE_TYPEINFO(QxtMailAttachment, Q_MOVABLE_TYPE);
@@ -0,0 +1,653 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+/*!
+ * \class QxtMailIndex
+ * \inmodule QxtNetwork
+ * \brief The QxtMailIndex class keeps an on-disk index of stored messages
+ *
+ * For each message, the index records where it is stored, its Message-ID,
+ * From, To, Subject and Date fields, and the offsets of its MIME parts, so
+ * that messages can be listed and found without reading them again. Messages
+ * are added with append() as they are stored; QxtMailMaildir does this itself
+ * when given an index with QxtMailMaildir::setIndex().
+ *
+ * The file is memory mapped. After sync() or close(), it ends with a hash table
+ * of the Message-IDs and a table of the records in order, so that find() and
+ * entry() only read the record they need. Records appended since the last
+ * sync() are found through an index kept in memory.
+ *
+ * \code
+ * QxtMailIndex index("archive.idx");
+ * QxtMailMbox mbox("archive.mbox");
+ * if (index.open() && mbox.open())
+ * {
+ *     while (mbox.next())
+ *         index.append(mbox.rawMessage(), mbox.messageOffset());
+ *     index.sync();
+ * }
+ * \endcode
+ */
+
+/*!
+ * \class QxtMailIndexEntry
+ * \inmodule QxtNetwork
+ * \brief The QxtMailIndexEntry struct holds what an index records about a message
+ */
+
+#include "mailindex.h"
+#include "mailrfc2822parser_p.h"
+#include <QFile>
+#include <QMultiHash>
+#include <QtEndian>
+#include <string.h>
+
+/*
+  Layout of an index file; all numbers are little endian.
+
+  header, 40 bytes:
+      0   "QXMI"
+      4   quint32 version
+      8   quint64 number of records
+      16  quint64 end of the records
+      24  quint64 offset of the tables, or 0 when they have to be rebuilt
+      32  reserved
+
+  record, starting at a multiple of 8 bytes from the start of the file:
+      0   quint32 size of the record, a multiple of 8
+      4   quint16 number of parts
+      6   reserved
+      8   quint64 offset of the message in its store
+      16  quint64 size of the message
+      24  quint64 hash of the Message-ID
+      32  quint16 lengths of the six strings below
+      44  reserved
+      48  parts, 16 bytes each: quint32 header offset, quint32 body offset,
+          quint32 end, quint16 depth, reserved
+      ... location, Message-ID, From, To, Subject and Date, in UTF-8
+
+  tables:
+      0   quint64 number of buckets, a power of two
+      8   buckets: quint64 record offsets, 0 for an empty bucket
+      ... quint64 record offsets, in the order of the records
+*/
+static const char QXT_INDEX_MAGIC[4] = { 'Q', 'X', 'M', 'I' };
+static const quint32 QXT_INDEX_VERSION = 1;
+static const int QXT_INDEX_HEADER_SIZE = 40;
+static const int QXT_INDEX_RECORD_SIZE = 48;
+static const int QXT_INDEX_PART_SIZE = 16;
+static const int QXT_INDEX_STRINGS = 6;
+
+static quint16 qxt_get16(const uchar* p)
+{
+    return qFromLittleEndian<quint16>(p);
+}
+
+static quint32 qxt_get32(const uchar* p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+static quint64 qxt_get64(const uchar* p)
+{
+    return qFromLittleEndian<quint64>(p);
+}
+
+static void qxt_put16(QByteArray& buffer, int pos, quint16 value)
+{
+    qToLittleEndian<quint16>(value, reinterpret_cast<uchar*>(buffer.data() + pos));
+}
+
+static void qxt_put32(QByteArray& buffer, int pos, quint32 value)
+{
+    qToLittleEndian<quint32>(value, reinterpret_cast<uchar*>(buffer.data() + pos));
+}
+
+static void qxt_put64(QByteArray& buffer, int pos, quint64 value)
+{
+    qToLittleEndian<quint64>(value, reinterpret_cast<uchar*>(buffer.data() + pos));
+}
+
+// FNV-1a, which unlike qHash() stays the same across Qt versions
+static quint64 qxt_id_hash(const QByteArray& id)
+{
+    quint64 rv = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < id.size(); i++)
+    {
+        rv ^= uchar(id.at(i));
+        rv *= Q_UINT64_C(1099511628211);
+    }
+    return rv;
+}
+
+// appends the spans of entity and of its parts, depth first
+static void qxt_index_parts(const QxtRfc2822Entity& entity, int depth, QVector<QxtMailIndexPart>& parts)
+{
+    if (parts.count() == 0xffff)
+        return;
+    QxtMailIndexPart part;
+    part.headerOffset = entity.span.begin;
+    part.bodyOffset = entity.body.begin;
+    part.end = entity.span.end;
+    part.depth = depth;
+    parts.append(part);
+    foreach (const QxtRfc2822Entity& child, entity.parts)
+        qxt_index_parts(child, depth + 1, parts);
+}
+
+#ifndef QXT_DOXYGEN_RUN
+class QxtMailIndexPrivate
+{
+public:
+    QxtMailIndexPrivate() : map(0), mapSize(0)
+    {
+        reset();
+    }
+
+    QFile file;
+    QString errorString;
+    // the file mapped for reading, mapped again when it grew
+    mutable uchar* map;
+    mutable qint64 mapSize;
+    quint64 count;
+    quint64 recordsEnd;
+    quint64 tableOffset;
+    // without tables, the offsets of the records in order and by Message-ID hash
+    QVector<quint64> records;
+    QMultiHash<quint64, quint64> ids;
+
+    void reset()
+    {
+        count = 0;
+        recordsEnd = QXT_INDEX_HEADER_SIZE;
+        tableOffset = 0;
+        records.clear();
+        ids.clear();
+    }
+
+    bool mapFile() const;
+    void unmapFile() const;
+    bool fail(const QString& error);
+    bool writeHeader();
+    bool scanRecords();
+    bool dropTables();
+    bool writeTables();
+    bool isRecord(quint64 offset) const;
+    quint64 recordOffset(int i) const;
+    QByteArray recordId(quint64 offset) const;
+    QxtMailIndexEntry readEntry(quint64 offset) const;
+};
+#endif
+
+bool QxtMailIndexPrivate::mapFile() const
+{
+    const qint64 size = file.size();
+    if (map && mapSize == size)
+        return true;
+    unmapFile();
+    map = const_cast<QFile&>(file).map(0, size);
+    if (!map)
+        return false;
+    mapSize = size;
+    return true;
+}
+
+void QxtMailIndexPrivate::unmapFile() const
+{
+    if (map)
+        const_cast<QFile&>(file).unmap(map);
+    map = 0;
+    mapSize = 0;
+}
+
+bool QxtMailIndexPrivate::fail(const QString& error)
+{
+    errorString = error;
+    return false;
+}
+
+bool QxtMailIndexPrivate::writeHeader()
+{
+    QByteArray header(QXT_INDEX_HEADER_SIZE, '\0');
+    memcpy(header.data(), QXT_INDEX_MAGIC, 4);
+    qxt_put32(header, 4, QXT_INDEX_VERSION);
+    qxt_put64(header, 8, count);
+    qxt_put64(header, 16, recordsEnd);
+    qxt_put64(header, 24, tableOffset);
+    if (!file.seek(0) || file.write(header) != header.size())
+        return fail(file.errorString());
+    return true;
+}
+
+// returns true if a whole record starts at offset
+bool QxtMailIndexPrivate::isRecord(quint64 offset) const
+{
+    if (offset < quint64(QXT_INDEX_HEADER_SIZE) || offset + QXT_INDEX_RECORD_SIZE > recordsEnd || offset % 8)
+        return false;
+    const quint32 size = qxt_get32(map + offset);
+    return size >= quint32(QXT_INDEX_RECORD_SIZE) && size % 8 == 0 && offset + size <= recordsEnd;
+}
+
+// reads the offsets of the records of a file without tables
+bool QxtMailIndexPrivate::scanRecords()
+{
+    records.clear();
+    ids.clear();
+    if (recordsEnd == quint64(QXT_INDEX_HEADER_SIZE))
+        return true;
+    if (!mapFile())
+        return fail(file.errorString());
+    for (quint64 offset = QXT_INDEX_HEADER_SIZE; offset < recordsEnd; offset += qxt_get32(map + offset))
+    {
+        if (!isRecord(offset))
+            return fail(QStringLiteral("corrupt index record at %1").arg(offset));
+        records.append(offset);
+        ids.insert(qxt_get64(map + offset + 24), offset);
+    }
+    count = records.count();
+    return true;
+}
+
+// Moves the record offsets from the tables to memory and cuts the tables off,
+// so that new records can follow the others.
+bool QxtMailIndexPrivate::dropTables()
+{
+    if (!mapFile())
+        return fail(file.errorString());
+    records.clear();
+    ids.clear();
+    records.reserve(count);
+    for (quint64 i = 0; i < count; i++)
+    {
+        const quint64 offset = recordOffset(int(i));
+        records.append(offset);
+        ids.insert(qxt_get64(map + offset + 24), offset);
+    }
+    unmapFile();
+    tableOffset = 0;
+    if (!file.resize(recordsEnd))
+        return fail(file.errorString());
+    return writeHeader();
+}
+
+bool QxtMailIndexPrivate::writeTables()
+{
+    if (!file.flush() || !mapFile())
+        return fail(file.errorString());
+    // at most half full, so that probes stay short
+    quint64 buckets = 16;
+    while (buckets < 2 * count)
+        buckets *= 2;
+    const quint64 mask = buckets - 1;
+    QByteArray tables(int(8 + 8 * buckets + 8 * count), '\0');
+    qxt_put64(tables, 0, buckets);
+    for (quint64 i = 0; i < count; i++)
+    {
+        const quint64 offset = records.at(int(i));
+        quint64 bucket = qxt_get64(map + offset + 24) & mask;
+        while (qxt_get64(reinterpret_cast<const uchar*>(tables.constData()) + 8 + 8 * bucket))
+            bucket = (bucket + 1) & mask;
+        qxt_put64(tables, int(8 + 8 * bucket), offset);
+        qxt_put64(tables, int(8 + 8 * buckets + 8 * i), offset);
+    }
+    if (!file.seek(recordsEnd) || file.write(tables) != tables.size())
+        return fail(file.errorString());
+    tableOffset = recordsEnd;
+    if (!writeHeader() || !file.flush())
+        return false;
+    records.clear();
+    ids.clear();
+    return true;
+}
+
+quint64 QxtMailIndexPrivate::recordOffset(int i) const
+{
+    if (!tableOffset)
+        return records.at(i);
+    const quint64 buckets = qxt_get64(map + tableOffset);
+    return qxt_get64(map + tableOffset + 8 + 8 * buckets + 8 * quint64(i));
+}
+
+QByteArray QxtMailIndexPrivate::recordId(quint64 offset) const
+{
+    const uchar* record = map + offset;
+    const quint64 strings = offset + QXT_INDEX_RECORD_SIZE + QXT_INDEX_PART_SIZE * qxt_get16(record + 4) + qxt_get16(record + 32);
+    const int length = qxt_get16(record + 34);
+    if (strings + length > offset + qxt_get32(record))
+        return QByteArray();
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(map + strings), length);
+}
+
+QxtMailIndexEntry QxtMailIndexPrivate::readEntry(quint64 offset) const
+{
+    QxtMailIndexEntry rv;
+    if (!mapFile() || !isRecord(offset))
+        return rv;
+    const uchar* record = map + offset;
+    const int partCount = qxt_get16(record + 4);
+    int lengths[QXT_INDEX_STRINGS];
+    quint64 size = QXT_INDEX_RECORD_SIZE + QXT_INDEX_PART_SIZE * partCount;
+    for (int i = 0; i < QXT_INDEX_STRINGS; i++)
+    {
+        lengths[i] = qxt_get16(record + 32 + 2 * i);
+        size += lengths[i];
+    }
+    if (size > qxt_get32(record))
+        return rv;
+
+    rv.offset = qxt_get64(record + 8);
+    rv.size = qxt_get64(record + 16);
+    rv.parts.resize(partCount);
+    const uchar* p = record + QXT_INDEX_RECORD_SIZE;
+    for (int i = 0; i < partCount; i++, p += QXT_INDEX_PART_SIZE)
+    {
+        QxtMailIndexPart& part = rv.parts[i];
+        part.headerOffset = qxt_get32(p);
+        part.bodyOffset = qxt_get32(p + 4);
+        part.end = qxt_get32(p + 8);
+        part.depth = qxt_get16(p + 12);
+    }
+    const char* s = reinterpret_cast<const char*>(p);
+    rv.location = QString::fromUtf8(s, lengths[0]);
+    s += lengths[0];
+    rv.messageId = QByteArray(s, lengths[1]);
+    s += lengths[1];
+    rv.from = QString::fromUtf8(s, lengths[2]);
+    s += lengths[2];
+    rv.to = QString::fromUtf8(s, lengths[3]);
+    s += lengths[3];
+    rv.subject = QString::fromUtf8(s, lengths[4]);
+    s += lengths[4];
+    rv.date = QString::fromUtf8(s, lengths[5]);
+    return rv;
+}
+
+/*!
+  Constructs an index without a file.
+  */
+QxtMailIndex::QxtMailIndex() : d_ptr(new QxtMailIndexPrivate)
+{
+}
+
+/*!
+  Constructs an index kept in the file \a fileName.
+  */
+QxtMailIndex::QxtMailIndex(const QString& fileName) : d_ptr(new QxtMailIndexPrivate)
+{
+    d_ptr->file.setFileName(fileName);
+}
+
+/*!
+  Destroys the index, closing its file.
+  */
+QxtMailIndex::~QxtMailIndex()
+{
+    close();
+}
+
+QString QxtMailIndex::fileName() const
+{
+    return d_ptr->file.fileName();
+}
+
+/*!
+  Sets the name of the index file to \a fileName. The index is closed.
+  */
+void QxtMailIndex::setFileName(const QString& fileName)
+{
+    close();
+    d_ptr->file.setFileName(fileName);
+}
+
+/*!
+  Opens the index file, creating it if it doesn't exist. Returns false if the
+  file can't be opened or isn't a valid index.
+
+  \sa errorString()
+  */
+bool QxtMailIndex::open()
+{
+    Q_D(QxtMailIndex);
+    close();
+    if (!d->file.open(QIODevice::ReadWrite))
+        return d->fail(d->file.errorString());
+    d->errorString.clear();
+    if (d->file.size() == 0)
+        return d->writeHeader() && d->file.flush();
+
+    const QByteArray header = d->file.read(QXT_INDEX_HEADER_SIZE);
+    const uchar* h = reinterpret_cast<const uchar*>(header.constData());
+    const quint64 size = d->file.size();
+    bool valid = header.size() == QXT_INDEX_HEADER_SIZE && memcmp(h, QXT_INDEX_MAGIC, 4) == 0
+                 && qxt_get32(h + 4) == QXT_INDEX_VERSION;
+    if (valid)
+    {
+        d->count = qxt_get64(h + 8);
+        d->recordsEnd = qxt_get64(h + 16);
+        d->tableOffset = qxt_get64(h + 24);
+        valid = d->recordsEnd >= quint64(QXT_INDEX_HEADER_SIZE) && d->recordsEnd <= size
+                && (!d->tableOffset || (d->tableOffset == d->recordsEnd && d->tableOffset + 8 <= size));
+    }
+    if (valid && d->tableOffset)
+    {
+        valid = d->mapFile();
+        const quint64 buckets = valid ? qxt_get64(d->map + d->tableOffset) : 0;
+        valid = valid && buckets && !(buckets & (buckets - 1)) && d->tableOffset + 8 + 8 * buckets + 8 * d->count <= size;
+    }
+    if (!valid)
+        d->fail(QStringLiteral("%1 is not a valid mail index").arg(d->file.fileName()));
+    if (!valid || (!d->tableOffset && !d->scanRecords()))
+    {
+        // closed without writing anything to the file
+        d->unmapFile();
+        d->file.close();
+        d->reset();
+        return false;
+    }
+    return true;
+}
+
+/*!
+  Writes the tables of the index if records were added, and closes the file.
+  */
+void QxtMailIndex::close()
+{
+    Q_D(QxtMailIndex);
+    if (d->file.isOpen() && !d->tableOffset && d->count)
+        d->writeTables();
+    d->unmapFile();
+    d->file.close();
+    d->reset();
+}
+
+bool QxtMailIndex::isOpen() const
+{
+    return d_ptr->file.isOpen();
+}
+
+/*!
+  Returns a description of the last error that occurred.
+  */
+QString QxtMailIndex::errorString() const
+{
+    return d_ptr->errorString;
+}
+
+/*!
+  Returns the number of messages in the index.
+  */
+int QxtMailIndex::count() const
+{
+    return int(d_ptr->count);
+}
+
+/*!
+  Returns the entry of message \a i, counting in the order the messages were
+  appended.
+  */
+QxtMailIndexEntry QxtMailIndex::entry(int i) const
+{
+    Q_D(const QxtMailIndex);
+    if (i < 0 || quint64(i) >= d->count || !d->mapFile())
+        return QxtMailIndexEntry();
+    return d->readEntry(d->recordOffset(i));
+}
+
+/*!
+  Returns the entry of the message with the Message-ID \a messageId, including
+  its angle brackets, or an invalid entry if there is none.
+  */
+QxtMailIndexEntry QxtMailIndex::find(const QByteArray& messageId) const
+{
+    Q_D(const QxtMailIndex);
+    if (!d->count || !d->mapFile())
+        return QxtMailIndexEntry();
+    const QByteArray id = messageId.trimmed();
+    const quint64 hash = qxt_id_hash(id);
+    if (!d->tableOffset)
+    {
+        QMultiHash<quint64, quint64>::const_iterator i = d->ids.constFind(hash);
+        for (; i != d->ids.constEnd() && i.key() == hash; ++i)
+        {
+            if (d->recordId(i.value()) == id)
+                return d->readEntry(i.value());
+        }
+        return QxtMailIndexEntry();
+    }
+    const uchar* buckets = d->map + d->tableOffset + 8;
+    const quint64 mask = qxt_get64(d->map + d->tableOffset) - 1;
+    // a corrupt file may have a full table: each bucket is probed at most once
+    quint64 bucket = hash & mask;
+    for (quint64 probe = 0; probe <= mask; probe++, bucket = (bucket + 1) & mask)
+    {
+        const quint64 offset = qxt_get64(buckets + 8 * bucket);
+        if (!offset || !d->isRecord(offset))
+            break;
+        if (qxt_get64(d->map + offset + 24) == hash && d->recordId(offset) == id)
+            return d->readEntry(offset);
+    }
+    return QxtMailIndexEntry();
+}
+
+/*!
+  Adds the message held in \a rfc2822 to the index. \a offset and \a location
+  tell where it is stored, such as its offset in an mbox file or its unique name
+  in a Maildir. Only the header fields and the MIME structure of the message
+  are read.
+
+  The record is written at once, but the header of the file is only updated
+  with the tables, by sync() and close(); records appended after the last of
+  those are dropped if the index isn't closed.
+  */
+bool QxtMailIndex::append(const QByteArray& rfc2822, qint64 offset, const QString& location)
+{
+    Q_D(QxtMailIndex);
+    if (!d->file.isOpen())
+        return d->fail(QStringLiteral("the index is not open"));
+    if (d->tableOffset && !d->dropTables())
+        return false;
+
+    QxtRfc2822Parser parser;
+    parser.setBuffer(rfc2822);
+    QxtRfc2822Entity root;
+    parser.parseTree(QxtMailSpan(0, rfc2822.size()), root);
+    QVector<QxtMailIndexPart> parts;
+    qxt_index_parts(root, 0, parts);
+
+    static const char* const names[QXT_INDEX_STRINGS] = { 0, "message-id", "from", "to", "subject", "date" };
+    QByteArray strings[QXT_INDEX_STRINGS];
+    strings[0] = location.toUtf8();
+    for (int i = 1; i < QXT_INDEX_STRINGS; i++)
+    {
+        const QString name = QLatin1String(names[i]);
+        foreach (const QxtRfc2822Field& field, root.fields)
+        {
+            if (parser.fieldNameIs(field, name))
+            {
+                const QString value = parser.fieldValue(field).trimmed();
+                strings[i] = i == 1 ? value.toLatin1() : value.toUtf8();
+                break;
+            }
+        }
+    }
+
+    int size = QXT_INDEX_RECORD_SIZE + QXT_INDEX_PART_SIZE * parts.count();
+    for (int i = 0; i < QXT_INDEX_STRINGS; i++)
+    {
+        strings[i].truncate(0xffff);
+        size += strings[i].size();
+    }
+    size = (size + 7) & ~7;
+    QByteArray record(size, '\0');
+    qxt_put32(record, 0, size);
+    qxt_put16(record, 4, parts.count());
+    qxt_put64(record, 8, offset);
+    qxt_put64(record, 16, rfc2822.size());
+    const quint64 hash = qxt_id_hash(strings[1]);
+    qxt_put64(record, 24, hash);
+    int pos = QXT_INDEX_RECORD_SIZE;
+    foreach (const QxtMailIndexPart& part, parts)
+    {
+        qxt_put32(record, pos, part.headerOffset);
+        qxt_put32(record, pos + 4, part.bodyOffset);
+        qxt_put32(record, pos + 8, part.end);
+        qxt_put16(record, pos + 12, part.depth);
+        pos += QXT_INDEX_PART_SIZE;
+    }
+    for (int i = 0; i < QXT_INDEX_STRINGS; i++)
+    {
+        qxt_put16(record, 32 + 2 * i, strings[i].size());
+        memcpy(record.data() + pos, strings[i].constData(), strings[i].size());
+        pos += strings[i].size();
+    }
+
+    if (!d->file.seek(d->recordsEnd) || d->file.write(record) != record.size())
+        return d->fail(d->file.errorString());
+    d->records.append(d->recordsEnd);
+    d->ids.insert(hash, d->recordsEnd);
+    d->recordsEnd += size;
+    d->count++;
+    return true;
+}
+
+/*!
+  Writes the tables of the index, so that it can be opened and searched without
+  reading its records first.
+  */
+bool QxtMailIndex::sync()
+{
+    Q_D(QxtMailIndex);
+    if (!d->file.isOpen())
+        return false;
+    if (d->tableOffset || !d->count)
+        return d->file.flush();
+    return d->writeTables();
+}
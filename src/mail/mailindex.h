@@ -0,0 +1,101 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILINDEX_H
+#define MAILINDEX_H
+
+#include "mailglobal.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QScopedPointer>
+
+struct QxtMailIndexPart
+{
+    // offsets from the start of the message
+    qint64 headerOffset;
+    qint64 bodyOffset;
+    qint64 end;
+    int depth;
+};
+Q_DECLARE_TYPEINFO(QxtMailIndexPart, Q_PRIMITIVE_TYPE);
+
+struct QxtMailIndexEntry
+{
+    QxtMailIndexEntry() : offset(0), size(-1) {}
+
+    bool isValid() const { return size >= 0; }
+
+    // where the message is stored: an offset in a file, and a name such as the
+    // unique name of a Maildir message
+    qint64 offset;
+    qint64 size;
+    QString location;
+    QByteArray messageId;
+    QString from;
+    QString to;
+    QString subject;
+    QString date;
+    // the message itself, then its MIME parts in depth-first order
+    QVector<QxtMailIndexPart> parts;
+};
+
+class QxtMailIndexPrivate;
+class Q_MAIL_EXPORT QxtMailIndex
+{
+public:
+    QxtMailIndex();
+    explicit QxtMailIndex(const QString& fileName);
+    ~QxtMailIndex();
+
+    QString fileName() const;
+    void setFileName(const QString& fileName);
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    int count() const;
+    QxtMailIndexEntry entry(int i) const;
+    QxtMailIndexEntry find(const QByteArray& messageId) const;
+
+    bool append(const QByteArray& rfc2822, qint64 offset = 0, const QString& location = QString());
+    bool sync();
+
+private:
+    Q_DISABLE_COPY(QxtMailIndex)
+    Q_DECLARE_PRIVATE(QxtMailIndex)
+    QScopedPointer<QxtMailIndexPrivate> d_ptr;
+};
+
+#endif // MAILINDEX_H
@@ -0,0 +1,616 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+/*!
+ * \class QxtMailMaildir
+ * \inmodule QxtNetwork
+ * \brief The QxtMailMaildir class stores messages in a Maildir directory
+ *
+ * Messages are delivered the way Maildir requires: each one is written to tmp
+ * under a unique name, synced to disk, and then renamed into new, so that
+ * readers never see a partial message. deliver() takes a list of messages so
+ * that their files are synced together and the directory is synced once for
+ * all of them.
+ *
+ * A QxtMailMessage is written with the bytes it was parsed from, so it must have
+ * been parsed and not changed since; it is never rendered again, as that would
+ * encode its decoded fields anew.
+ *
+ * entries() lists new and cur, reading both directories and querying the size
+ * and time of the files in parallel. To find messages without listing or reading
+ * them, give the store a QxtMailIndex with setIndex().
+ */
+
+/*!
+ * \class QxtMailMaildirEntry
+ * \inmodule QxtNetwork
+ * \brief The QxtMailMaildirEntry struct describes a message file of a Maildir
+ */
+
+#include "mailmaildir.h"
+#include "mailindex.h"
+#include "mailmessage_p.h"
+#include "mailutility_p.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostInfo>
+#include <QAtomicInt>
+#include <QVector>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// files written before they are synced together
+static const int QXT_MAILDIR_BATCH = 64;
+// directory entries handed to one task of a scan
+static const int QXT_MAILDIR_STAT_BATCH = 1024;
+
+static QString qxt_folder_name(QxtMailMaildir::Folder folder)
+{
+    return folder == QxtMailMaildir::Cur ? QStringLiteral("cur") : QStringLiteral("new");
+}
+
+// returns a name following the usual time.MusecPpidQdeliveries.host form
+static QString qxt_maildir_unique_name()
+{
+    static QAtomicInt deliveries;
+    // '/' and ':' can't appear in the host part
+    static const QString host = QHostInfo::localHostName()
+                                .replace(QLatin1Char('/'), QLatin1String("\\057"))
+                                .replace(QLatin1Char(':'), QLatin1String("\\072"));
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    return QStringLiteral("%1.M%2P%3Q%4.").arg(now / 1000).arg((now % 1000) * 1000)
+           .arg(QCoreApplication::applicationPid()).arg(deliveries.fetchAndAddRelaxed(1) + 1) + host;
+}
+
+#ifdef Q_OS_UNIX
+// Writes data to a new file at path and returns its descriptor, left open so
+// that the file can be synced later, or -1.
+static int qxt_create_file(const QString& path, const QByteArray& data)
+{
+    const QByteArray name = QFile::encodeName(path);
+    int fd;
+    do
+    {
+        fd = ::open(name.constData(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    }
+    while (fd == -1 && errno == EINTR);
+    if (fd == -1)
+        return -1;
+    const char* p = data.constData();
+    qint64 left = data.size();
+    while (left > 0)
+    {
+        const ssize_t written = ::write(fd, p, left);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            const int error = errno;
+            ::close(fd);
+            ::unlink(name.constData());
+            errno = error;
+            return -1;
+        }
+        p += written;
+        left -= written;
+    }
+    return fd;
+}
+
+static bool qxt_sync_file(int fd)
+{
+#ifdef Q_OS_LINUX
+    return ::fdatasync(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+static bool qxt_sync_directory(const QString& path)
+{
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    const bool rv = ::fsync(fd) == 0;
+    ::close(fd);
+    return rv;
+}
+
+// names read from one folder, and the folder kept open to query its files
+struct QxtMaildirListing
+{
+    QxtMaildirListing() : folder(QxtMailMaildir::New), fd(-1) {}
+
+    QxtMailMaildir::Folder folder;
+    QString path;
+    int fd;
+    QList<QByteArray> names;
+};
+
+static void qxt_list_directory(QxtMaildirListing* listing)
+{
+    listing->fd = ::open(QFile::encodeName(listing->path).constData(), O_RDONLY | O_DIRECTORY);
+    if (listing->fd == -1)
+        return;
+    // the listing keeps its descriptor for fstatat(); readdir() gets a copy
+    const int copy = ::dup(listing->fd);
+    if (copy == -1)
+        return;
+    DIR* dir = ::fdopendir(copy);
+    if (!dir)
+    {
+        ::close(copy);
+        return;
+    }
+    while (struct dirent* entry = ::readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+            continue;
+#endif
+        listing->names.append(QByteArray(entry->d_name));
+    }
+    ::closedir(dir);
+}
+
+// Fills entries from the names of listing between begin and end. Files removed
+// since the folder was read keep a size of -1.
+static void qxt_stat_entries(const QxtMaildirListing* listing, QxtMailMaildirEntry* entries, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        const QByteArray& name = listing->names.at(i);
+        struct stat info;
+        if (::fstatat(listing->fd, name.constData(), &info, 0) != 0 || !S_ISREG(info.st_mode))
+            continue;
+        QxtMailMaildirEntry& entry = entries[i];
+        entry.folder = listing->folder;
+        entry.name = QFile::decodeName(name);
+        entry.size = info.st_size;
+        entry.modified = info.st_mtime;
+    }
+}
+#endif
+
+#ifndef QXT_DOXYGEN_RUN
+class QxtMailMaildirPrivate
+{
+public:
+    QxtMailMaildirPrivate() : index(0) {}
+
+    QString path;
+    QString errorString;
+    QxtMailIndex* index;
+
+    QString folderPath(QxtMailMaildir::Folder folder) const
+    {
+        return path + QLatin1Char('/') + qxt_folder_name(folder);
+    }
+
+    QStringList deliver(const QList<QByteArray>& messages);
+};
+#endif
+
+// Delivers messages in batches: the files of a batch are all written before
+// they are synced, then renamed into new, and new is synced once at the end.
+QStringList QxtMailMaildirPrivate::deliver(const QList<QByteArray>& messages)
+{
+    const QString tmp = path + QLatin1String("/tmp/");
+    const QString dest = path + QLatin1String("/new/");
+    QStringList rv;
+    rv.reserve(messages.count());
+    bool moved = false;
+    for (int begin = 0; begin < messages.count(); begin += QXT_MAILDIR_BATCH)
+    {
+        const int end = qMin(messages.count(), begin + QXT_MAILDIR_BATCH);
+        QStringList names;
+#ifdef Q_OS_UNIX
+        QVector<int> files;
+        for (int i = begin; i < end; i++)
+        {
+            const QString name = qxt_maildir_unique_name();
+            const int fd = qxt_create_file(tmp + name, messages.at(i));
+            if (fd == -1)
+                errorString = qt_error_string(errno);
+            names.append(fd == -1 ? QString() : name);
+            files.append(fd);
+        }
+        for (int i = 0; i < files.count(); i++)
+        {
+            if (files.at(i) == -1)
+                continue;
+            if (!qxt_sync_file(files.at(i)))
+            {
+                errorString = qt_error_string(errno);
+                ::unlink(QFile::encodeName(tmp + names.at(i)).constData());
+                names[i].clear();
+            }
+            ::close(files.at(i));
+        }
+        for (int i = 0; i < names.count(); i++)
+        {
+            if (names.at(i).isEmpty())
+                continue;
+            const QByteArray from = QFile::encodeName(tmp + names.at(i));
+            if (::rename(from.constData(), QFile::encodeName(dest + names.at(i)).constData()) != 0)
+            {
+                errorString = qt_error_string(errno);
+                ::unlink(from.constData());
+                names[i].clear();
+                continue;
+            }
+            moved = true;
+        }
+#else
+        for (int i = begin; i < end; i++)
+        {
+            const QString name = qxt_maildir_unique_name();
+            QFile file(tmp + name);
+            if (!file.open(QIODevice::WriteOnly) || file.write(messages.at(i)) != messages.at(i).size() || !file.flush())
+            {
+                errorString = file.errorString();
+                file.remove();
+                names.append(QString());
+                continue;
+            }
+            file.close();
+            if (!file.rename(dest + name))
+            {
+                errorString = file.errorString();
+                file.remove();
+                names.append(QString());
+                continue;
+            }
+            names.append(name);
+            moved = true;
+        }
+#endif
+        rv += names;
+    }
+    if (index)
+    {
+        for (int i = 0; i < rv.count(); i++)
+        {
+            if (!rv.at(i).isEmpty() && !index->append(messages.at(i), 0, rv.at(i)))
+                errorString = index->errorString();
+        }
+    }
+#ifdef Q_OS_UNIX
+    // one sync makes all the renames of the delivery durable
+    if (moved && !qxt_sync_directory(path + QLatin1String("/new")))
+        errorString = qt_error_string(errno);
+#else
+    Q_UNUSED(moved);
+#endif
+    return rv;
+}
+
+/*!
+  Constructs a Maildir store without a path.
+  */
+QxtMailMaildir::QxtMailMaildir() : d_ptr(new QxtMailMaildirPrivate)
+{
+}
+
+/*!
+  Constructs a Maildir store for the directory \a path.
+  */
+QxtMailMaildir::QxtMailMaildir(const QString& path) : d_ptr(new QxtMailMaildirPrivate)
+{
+    d_ptr->path = path;
+}
+
+/*!
+  Destroys the object; the directory is left as it is.
+  */
+QxtMailMaildir::~QxtMailMaildir()
+{
+}
+
+QString QxtMailMaildir::path() const
+{
+    return d_ptr->path;
+}
+
+void QxtMailMaildir::setPath(const QString& path)
+{
+    d_ptr->path = path;
+}
+
+/*!
+  Makes deliver() add the messages it delivers to \a index, with their unique
+  names as locations. The index isn't owned by the store; pass 0 to stop.
+  */
+void QxtMailMaildir::setIndex(QxtMailIndex* index)
+{
+    d_ptr->index = index;
+}
+
+QxtMailIndex* QxtMailMaildir::index() const
+{
+    return d_ptr->index;
+}
+
+/*!
+  Returns true if the tmp, new and cur folders of the Maildir exist.
+  */
+bool QxtMailMaildir::exists() const
+{
+    Q_D(const QxtMailMaildir);
+    const QDir dir(d->path);
+    return dir.exists(QStringLiteral("tmp")) && dir.exists(QStringLiteral("new")) && dir.exists(QStringLiteral("cur"));
+}
+
+/*!
+  Creates the Maildir and its tmp, new and cur folders if they don't exist yet.
+  */
+bool QxtMailMaildir::create()
+{
+    Q_D(QxtMailMaildir);
+    QDir dir(d->path);
+    foreach (const QString& folder, QStringList() << QStringLiteral("tmp") << QStringLiteral("new") << QStringLiteral("cur"))
+    {
+        if (!dir.mkpath(folder))
+        {
+            d->errorString = QStringLiteral("cannot create %1").arg(dir.filePath(folder));
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+  Returns a description of the last error that occurred.
+  */
+QString QxtMailMaildir::errorString() const
+{
+    return d_ptr->errorString;
+}
+
+/*!
+  Delivers the message held in \a rfc2822 to new, and returns its unique name,
+  or an empty string on failure.
+  */
+QString QxtMailMaildir::deliver(const QByteArray& rfc2822)
+{
+    return d_ptr->deliver(QList<QByteArray>() << rfc2822).first();
+}
+
+/*!
+  \overload
+  */
+QString QxtMailMaildir::deliver(const QxtMailMessage& message)
+{
+    return deliver(QList<QxtMailMessage>() << message).first();
+}
+
+/*!
+  Delivers \a messages to new, and returns their unique names in the same order;
+  the name of a message that couldn't be delivered is empty. The files are
+  synced in batches and the directory once, so this is much faster than
+  delivering the messages one at a time.
+  */
+QStringList QxtMailMaildir::deliver(const QList<QByteArray>& messages)
+{
+    return d_ptr->deliver(messages);
+}
+
+/*!
+  \overload
+
+  Each message is written with the bytes it was received as: it must have been
+  parsed with QxtMailMessage::fromRfc2822(), or retrieved by a
+  QxtPop3RetrReply with setKeepRawMessage() enabled, and not changed since.
+  Other messages have no such source and are not delivered; their names are
+  empty.
+  */
+QStringList QxtMailMaildir::deliver(const QList<QxtMailMessage>& messages)
+{
+    QList<QByteArray> data;
+    data.reserve(messages.count());
+    QList<int> missing;
+    for (int i = 0; i < messages.count(); i++)
+    {
+        const QByteArray source = messages.at(i).qxt_d->source();
+        if (source.isNull())
+            missing.append(i);
+        else
+            data.append(source);
+    }
+    QStringList rv = d_ptr->deliver(data);
+    if (!missing.isEmpty())
+    {
+        d_ptr->errorString = QStringLiteral("Message has no RFC 2822 source to store");
+        foreach (int i, missing)
+            rv.insert(i, QString());
+    }
+    return rv;
+}
+
+/*!
+  Returns the message files of the given \a folders. The folders are read in
+  parallel on \a pool, or on the global thread pool if \a pool is null, and so
+  are the sizes and times of their files.
+  */
+QList<QxtMailMaildirEntry> QxtMailMaildir::entries(Folders folders, QThreadPool* pool) const
+{
+    Q_D(const QxtMailMaildir);
+    QList<QxtMailMaildirEntry> rv;
+#ifdef Q_OS_UNIX
+    if (!pool)
+        pool = QThreadPool::globalInstance();
+    QVector<QxtMaildirListing> listings;
+    for (int folder = New; folder <= Cur; folder <<= 1)
+    {
+        if (!(folders & Folder(folder)))
+            continue;
+        QxtMaildirListing listing;
+        listing.folder = Folder(folder);
+        listing.path = d->folderPath(listing.folder);
+        listings.append(listing);
+    }
+    QxtMaildirListing* data = listings.data();
+
+    QList<QFuture<void> > tasks;
+    for (int i = 1; i < listings.count(); i++)
+        tasks.append(QtConcurrent::run(pool, qxt_list_directory, data + i));
+    if (!listings.isEmpty())
+        qxt_list_directory(data);
+    foreach (QFuture<void> task, tasks)
+        task.waitForFinished();
+    tasks.clear();
+
+    int count = 0;
+    foreach (const QxtMaildirListing& listing, listings)
+        count += listing.names.count();
+    QVector<QxtMailMaildirEntry> found(count);
+    QxtMailMaildirEntry* entries = found.data();
+    for (int i = 0; i < listings.count(); i++)
+    {
+        const int size = data[i].names.count();
+        for (int begin = 0; begin < size; begin += QXT_MAILDIR_STAT_BATCH)
+            tasks.append(QtConcurrent::run(pool, qxt_stat_entries, data + i, entries, begin, qMin(size, begin + QXT_MAILDIR_STAT_BATCH)));
+        entries += size;
+    }
+    foreach (QFuture<void> task, tasks)
+        task.waitForFinished();
+    for (int i = 0; i < listings.count(); i++)
+    {
+        if (data[i].fd != -1)
+            ::close(data[i].fd);
+    }
+
+    rv.reserve(count);
+    foreach (const QxtMailMaildirEntry& entry, found)
+    {
+        if (entry.size >= 0)
+            rv.append(entry);
+    }
+#else
+    Q_UNUSED(pool);
+    for (int folder = New; folder <= Cur; folder <<= 1)
+    {
+        if (!(folders & Folder(folder)))
+            continue;
+        const QDir dir(d->folderPath(Folder(folder)));
+        foreach (const QFileInfo& info, dir.entryInfoList(QDir::Files))
+        {
+            QxtMailMaildirEntry entry;
+            entry.folder = Folder(folder);
+            entry.name = info.fileName();
+            entry.size = info.size();
+            entry.modified = info.lastModified().toMSecsSinceEpoch() / 1000;
+            rv.append(entry);
+        }
+    }
+#endif
+    return rv;
+}
+
+/*!
+  Returns the path of the file of \a entry.
+  */
+QString QxtMailMaildir::filePath(const QxtMailMaildirEntry& entry) const
+{
+    return d_ptr->folderPath(entry.folder) + QLatin1Char('/') + entry.name;
+}
+
+/*!
+  Returns the content of the file of \a entry as it is stored.
+  */
+QByteArray QxtMailMaildir::read(const QxtMailMaildirEntry& entry) const
+{
+    QFile file(filePath(entry));
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+/*!
+  Parses the message of \a entry with the given parse \a mode. Files stored
+  with bare LF line breaks are read as CRLF.
+  */
+QxtMailMessage QxtMailMaildir::message(const QxtMailMaildirEntry& entry, QxtMailMessage::ParseMode mode) const
+{
+    return QxtMailMessage::fromRfc2822(qxt_crlf_lines(read(entry)), mode);
+}
+
+/*!
+  Sets the flags of the message of \a entry to \a flags, such as "S" for a seen
+  message, moving it to cur. \a entry is updated on success.
+  */
+bool QxtMailMaildir::setFlags(QxtMailMaildirEntry& entry, const QString& flags)
+{
+    Q_D(QxtMailMaildir);
+    // the flags are kept sorted and unique
+    QString info = flags;
+    std::sort(info.begin(), info.end());
+    info.truncate(std::unique(info.begin(), info.end()) - info.begin());
+    const QString name = entry.uniqueName() + QLatin1String(":2,") + info;
+    const QString to = d->folderPath(Cur) + QLatin1Char('/') + name;
+    QFile file(filePath(entry));
+    if (!file.rename(to))
+    {
+        d->errorString = file.errorString();
+        return false;
+    }
+    entry.folder = Cur;
+    entry.name = name;
+    return true;
+}
+
+/*!
+  Removes the file of \a entry.
+  */
+bool QxtMailMaildir::remove(const QxtMailMaildirEntry& entry)
+{
+    Q_D(QxtMailMaildir);
+    QFile file(filePath(entry));
+    if (!file.remove())
+    {
+        d->errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
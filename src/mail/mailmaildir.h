@@ -0,0 +1,112 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILMAILDIR_H
+#define MAILMAILDIR_H
+
+#include "mailglobal.h"
+#include "mailmessage.h"
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QByteArray>
+#include <QScopedPointer>
+
+class QThreadPool;
+class QxtMailIndex;
+struct QxtMailMaildirEntry;
+
+class QxtMailMaildirPrivate;
+class Q_MAIL_EXPORT QxtMailMaildir
+{
+public:
+    enum Folder
+    {
+        New = 0x1,
+        Cur = 0x2
+    };
+    Q_DECLARE_FLAGS(Folders, Folder)
+
+    QxtMailMaildir();
+    explicit QxtMailMaildir(const QString& path);
+    ~QxtMailMaildir();
+
+    QString path() const;
+    void setPath(const QString& path);
+
+    QxtMailIndex* index() const;
+    void setIndex(QxtMailIndex* index);
+
+    bool exists() const;
+    bool create();
+    QString errorString() const;
+
+    QString deliver(const QByteArray& rfc2822);
+    QString deliver(const QxtMailMessage& message);
+    QStringList deliver(const QList<QByteArray>& messages);
+    QStringList deliver(const QList<QxtMailMessage>& messages);
+
+    QList<QxtMailMaildirEntry> entries(Folders folders = Folders(New | Cur), QThreadPool* pool = 0) const;
+    QString filePath(const QxtMailMaildirEntry& entry) const;
+    QByteArray read(const QxtMailMaildirEntry& entry) const;
+    QxtMailMessage message(const QxtMailMaildirEntry& entry, QxtMailMessage::ParseMode mode = QxtMailMessage::FullParse) const;
+    bool setFlags(QxtMailMaildirEntry& entry, const QString& flags);
+    bool remove(const QxtMailMaildirEntry& entry);
+
+private:
+    Q_DISABLE_COPY(QxtMailMaildir)
+    Q_DECLARE_PRIVATE(QxtMailMaildir)
+    QScopedPointer<QxtMailMaildirPrivate> d_ptr;
+};
+Q_DECLARE_OPERATORS_FOR_FLAGS(QxtMailMaildir::Folders)
+
+struct QxtMailMaildirEntry
+{
+    QxtMailMaildirEntry() : folder(QxtMailMaildir::New), size(-1), modified(0) {}
+
+    QxtMailMaildir::Folder folder;
+    // file name: the unique name, followed by the info in cur
+    QString name;
+    qint64 size;
+    // time of the last modification, in seconds since the epoch
+    qint64 modified;
+
+    QString uniqueName() const { return name.section(QLatin1Char(':'), 0, 0); }
+    QString flags() const
+    {
+        const int info = name.indexOf(QLatin1String(":2,"));
+        return info == -1 ? QString() : name.mid(info + 3);
+    }
+};
+Q_DECLARE_TYPEINFO(QxtMailMaildirEntry, Q_MOVABLE_TYPE);
+
+#endif // MAILMAILDIR_H
@@ -0,0 +1,470 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+/*!
+ * \class QxtMailMbox
+ * \inmodule QxtNetwork
+ * \brief The QxtMailMbox class reads the messages of an mbox file one at a time
+ *
+ * The file is mapped into memory a window at a time, so that files larger than
+ * the address space can be read. Each call to next() finds the next message by
+ * looking for the next line starting with "From "; the message is only copied
+ * when messageData() or message() is called.
+ *
+ * \code
+ * QxtMailMbox mbox("archive.mbox");
+ * if (mbox.open())
+ * {
+ *     while (mbox.next())
+ *         process(mbox.message(QxtMailMessage::LazyParse));
+ * }
+ * \endcode
+ *
+ * Both the mboxo and the mboxrd variants are read: lines of the messages that
+ * start with one or more '>' followed by "From " lose their first '>'.
+ */
+
+#include "mailmbox.h"
+#include <QFile>
+#include <QtAlgorithms>
+#include <limits.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// size of the part of the file that is mapped at once; a longer message gets
+// a window of its own
+static const qint64 QXT_MBOX_WINDOW = Q_INT64_C(64) * 1024 * 1024;
+
+// Returns the position of the first line of data starting with "From " at or
+// after from, or -1 if there is none before size. Position 0 is taken as the
+// start of a line; otherwise data[from - 1] must be readable.
+static qint64 qxt_find_from_line(const char* data, qint64 from, qint64 size)
+{
+    if (from == 0)
+    {
+        if (size >= 5 && memcmp(data, "From ", 5) == 0)
+            return 0;
+        from = 1;
+    }
+    // newlines are searched from the end of the line before from
+    qint64 i = from - 1;
+    while (i + 6 <= size)
+    {
+#ifdef __SSE2__
+        if (size - i >= 16)
+        {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            uint mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+            while (mask)
+            {
+                const qint64 newline = i + qCountTrailingZeroBits(mask);
+                if (newline + 6 <= size && memcmp(data + newline + 1, "From ", 5) == 0)
+                    return newline + 1;
+                mask &= mask - 1;
+            }
+            i += 16;
+            continue;
+        }
+#endif
+        const char* newline = static_cast<const char*>(memchr(data + i, '\n', size - i));
+        if (!newline)
+            break;
+        i = newline - data;
+        if (i + 6 <= size && memcmp(newline + 1, "From ", 5) == 0)
+            return i + 1;
+        i++;
+    }
+    return -1;
+}
+
+static qint64 qxt_find_newline(const char* data, qint64 from, qint64 size)
+{
+    const char* newline = static_cast<const char*>(memchr(data + from, '\n', size - from));
+    return newline ? newline - data : -1;
+}
+
+#ifndef QXT_DOXYGEN_RUN
+class QxtMailMboxPrivate
+{
+public:
+    enum Target
+    {
+        Newline,
+        Separator
+    };
+
+    QxtMailMboxPrivate() : window(0), windowBegin(0), windowEnd(0), fileSize(0), pos(0)
+    {
+        clearMessage();
+    }
+
+    QFile file;
+    QString errorString;
+    uchar* window;
+    qint64 windowBegin;
+    qint64 windowEnd;
+    qint64 fileSize;
+    // start of the separator line of the next message
+    qint64 pos;
+    // spans of the current message in the file; the envelope is the From line
+    // without "From " and without its line break
+    qint64 messageStart;
+    qint64 envelopeBegin;
+    qint64 envelopeEnd;
+    qint64 messageBegin;
+    qint64 messageEnd;
+
+    const char* at(qint64 offset) const
+    {
+        return reinterpret_cast<const char*>(window) + (offset - windowBegin);
+    }
+
+    void clearMessage()
+    {
+        messageStart = envelopeBegin = envelopeEnd = messageBegin = messageEnd = -1;
+    }
+
+    bool map(qint64 begin, qint64 end);
+    void unmap();
+    qint64 find(qint64 keep, qint64 from, Target target);
+};
+#endif
+
+// makes sure that the bytes from begin to end are mapped
+bool QxtMailMboxPrivate::map(qint64 begin, qint64 end)
+{
+    if (window && begin >= windowBegin && end <= windowEnd)
+        return true;
+    unmap();
+    // map ahead, so that the next messages are usually found in the same window
+    end = qMax(end, qMin(fileSize, begin + QXT_MBOX_WINDOW));
+    window = file.map(begin, end - begin);
+    if (!window)
+    {
+        errorString = file.errorString();
+        return false;
+    }
+    windowBegin = begin;
+    windowEnd = end;
+    return true;
+}
+
+void QxtMailMboxPrivate::unmap()
+{
+    if (window)
+        file.unmap(window);
+    window = 0;
+    windowBegin = windowEnd = 0;
+}
+
+// Returns the offset of the next newline or separator line at or after from, the
+// file size if there is none, or -1 if the file can't be mapped. The window
+// already mapped is scanned first; it is only slid to keep, or grown, when the
+// target isn't in it, and it always keeps the bytes from keep on.
+qint64 QxtMailMboxPrivate::find(qint64 keep, qint64 from, Target target)
+{
+    if (!map(keep, from))
+        return -1;
+    forever
+    {
+        const char* data = at(windowBegin);
+        const qint64 found = target == Separator ? qxt_find_from_line(data, from - windowBegin, windowEnd - windowBegin)
+                                                 : qxt_find_newline(data, from - windowBegin, windowEnd - windowBegin);
+        if (found != -1)
+            return windowBegin + found;
+        if (windowEnd == fileSize)
+            return fileSize;
+        // a separator may start in the last bytes scanned
+        from = qMax(from, windowEnd - 6);
+        if (!map(keep, qMin(fileSize, keep + qMax(QXT_MBOX_WINDOW, 2 * (windowEnd - keep)))))
+            return -1;
+    }
+}
+
+/*!
+  Constructs an mbox reader without a file.
+  */
+QxtMailMbox::QxtMailMbox() : d_ptr(new QxtMailMboxPrivate)
+{
+}
+
+/*!
+  Constructs an mbox reader for the file \a fileName.
+  */
+QxtMailMbox::QxtMailMbox(const QString& fileName) : d_ptr(new QxtMailMboxPrivate)
+{
+    d_ptr->file.setFileName(fileName);
+}
+
+/*!
+  Destroys the reader and closes the file.
+  */
+QxtMailMbox::~QxtMailMbox()
+{
+    close();
+}
+
+QString QxtMailMbox::fileName() const
+{
+    return d_ptr->file.fileName();
+}
+
+/*!
+  Sets the name of the file to read to \a fileName. The file is closed.
+  */
+void QxtMailMbox::setFileName(const QString& fileName)
+{
+    close();
+    d_ptr->file.setFileName(fileName);
+}
+
+/*!
+  Opens the file for reading and moves to its start. Returns false if the file
+  can't be opened.
+
+  \sa errorString()
+  */
+bool QxtMailMbox::open()
+{
+    Q_D(QxtMailMbox);
+    close();
+    if (!d->file.open(QIODevice::ReadOnly))
+    {
+        d->errorString = d->file.errorString();
+        return false;
+    }
+    d->errorString.clear();
+    d->fileSize = d->file.size();
+    d->pos = 0;
+    return true;
+}
+
+void QxtMailMbox::close()
+{
+    Q_D(QxtMailMbox);
+    d->unmap();
+    d->file.close();
+    d->fileSize = 0;
+    d->pos = 0;
+    d->clearMessage();
+}
+
+bool QxtMailMbox::isOpen() const
+{
+    return d_ptr->file.isOpen();
+}
+
+/*!
+  Returns a description of the last error that occurred.
+  */
+QString QxtMailMbox::errorString() const
+{
+    return d_ptr->errorString;
+}
+
+qint64 QxtMailMbox::size() const
+{
+    return d_ptr->fileSize;
+}
+
+/*!
+  Returns the offset in the file of the next message that next() will read.
+  */
+qint64 QxtMailMbox::pos() const
+{
+    return d_ptr->pos;
+}
+
+/*!
+  Makes next() read the message at \a offset, which should be the start of a
+  separator line, such as a value returned by messageOffset() before. Returns
+  false if \a offset is outside the file.
+  */
+bool QxtMailMbox::seek(qint64 offset)
+{
+    Q_D(QxtMailMbox);
+    if (!d->file.isOpen() || offset < 0 || offset > d->fileSize)
+        return false;
+    d->pos = offset;
+    d->clearMessage();
+    return true;
+}
+
+bool QxtMailMbox::atEnd() const
+{
+    return d_ptr->pos >= d_ptr->fileSize;
+}
+
+/*!
+  Moves to the next message of the file. Returns false at the end of the file,
+  or if the file can't be mapped.
+
+  A file that doesn't start with a "From " line is read as one message up to the
+  first separator.
+  */
+bool QxtMailMbox::next()
+{
+    Q_D(QxtMailMbox);
+    d->clearMessage();
+    if (!d->file.isOpen() || d->pos >= d->fileSize)
+        return false;
+    const qint64 start = d->pos;
+    qint64 begin = start;
+    qint64 envelopeBegin = start;
+    qint64 envelopeEnd = start;
+    if (!d->map(start, qMin(d->fileSize, start + 5)))
+        return false;
+    if (d->fileSize - start >= 5 && memcmp(d->at(start), "From ", 5) == 0)
+    {
+        const qint64 newline = d->find(start, start, QxtMailMboxPrivate::Newline);
+        if (newline < 0)
+            return false;
+        envelopeBegin = start + 5;
+        envelopeEnd = newline;
+        if (envelopeEnd > envelopeBegin && *d->at(envelopeEnd - 1) == '\r')
+            envelopeEnd--;
+        begin = qMin(newline + 1, d->fileSize);
+    }
+    const qint64 separator = d->find(start, begin, QxtMailMboxPrivate::Separator);
+    if (separator < 0)
+        return false;
+    // the empty line before a separator belongs to the format, not to the message
+    qint64 end = separator;
+    if (end - begin >= 2 && *d->at(end - 1) == '\n')
+    {
+        if (*d->at(end - 2) == '\n')
+            end--;
+        else if (end - begin >= 4 && *d->at(end - 2) == '\r' && *d->at(end - 3) == '\n')
+            end -= 2;
+    }
+    d->messageStart = start;
+    d->envelopeBegin = envelopeBegin;
+    d->envelopeEnd = envelopeEnd;
+    d->messageBegin = begin;
+    d->messageEnd = end;
+    d->pos = separator;
+    return true;
+}
+
+/*!
+  Returns the offset in the file of the separator line of the current message,
+  or -1 if there is no current message.
+
+  \sa seek()
+  */
+qint64 QxtMailMbox::messageOffset() const
+{
+    return d_ptr->messageStart;
+}
+
+/*!
+  Returns the size of the current message as it is stored in the file, without
+  its separator line.
+  */
+qint64 QxtMailMbox::messageSize() const
+{
+    return d_ptr->messageEnd - d_ptr->messageBegin;
+}
+
+/*!
+  Returns the sender and the date of the separator line of the current message,
+  which is everything after "From ".
+  */
+QByteArray QxtMailMbox::envelope() const
+{
+    Q_D(const QxtMailMbox);
+    if (d->envelopeEnd <= d->envelopeBegin)
+        return QByteArray();
+    return QByteArray(d->at(d->envelopeBegin), d->envelopeEnd - d->envelopeBegin);
+}
+
+/*!
+  Returns the current message as it is stored in the file, without copying it.
+  The returned array points into the mapped file and is only valid until the
+  next call to next(), seek() or close(); copy it to keep it longer.
+
+  \sa messageData()
+  */
+QByteArray QxtMailMbox::rawMessage() const
+{
+    Q_D(const QxtMailMbox);
+    const qint64 size = d->messageEnd - d->messageBegin;
+    if (d->messageBegin < 0 || size > INT_MAX)
+        return QByteArray();
+    return QByteArray::fromRawData(d->at(d->messageBegin), int(size));
+}
+
+/*!
+  Returns a copy of the current message with its quoted "From " lines restored
+  and its lines ending with CRLF, as QxtMailMessage expects.
+  */
+QByteArray QxtMailMbox::messageData() const
+{
+    const QByteArray raw = rawMessage();
+    const char* data = raw.constData();
+    const int size = raw.size();
+    QByteArray rv;
+    rv.reserve(size + size / 32);
+    int line = 0;
+    while (line < size)
+    {
+        // >From, >>From... lose one '>'
+        int quote = line;
+        while (quote < size && data[quote] == '>')
+            quote++;
+        if (quote > line && size - quote >= 5 && memcmp(data + quote, "From ", 5) == 0)
+            line++;
+        const char* newline = static_cast<const char*>(memchr(data + line, '\n', size - line));
+        const int end = newline ? int(newline - data) : size;
+        if (newline && end > line && data[end - 1] == '\r')
+            rv.append(data + line, end + 1 - line);
+        else
+        {
+            rv.append(data + line, end - line);
+            if (newline)
+                rv.append("\r\n", 2);
+        }
+        line = end + 1;
+    }
+    return rv;
+}
+
+/*!
+  Parses the current message with the given parse \a mode.
+
+  \sa QxtMailMessage::fromRfc2822()
+  */
+QxtMailMessage QxtMailMbox::message(QxtMailMessage::ParseMode mode) const
+{
+    return QxtMailMessage::fromRfc2822(messageData(), mode);
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILMBOX_H
+#define MAILMBOX_H
+
+#include "mailglobal.h"
+#include "mailmessage.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QScopedPointer>
+
+class QxtMailMboxPrivate;
+class Q_MAIL_EXPORT QxtMailMbox
+{
+public:
+    QxtMailMbox();
+    explicit QxtMailMbox(const QString& fileName);
+    ~QxtMailMbox();
+
+    QString fileName() const;
+    void setFileName(const QString& fileName);
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    qint64 size() const;
+    qint64 pos() const;
+    bool seek(qint64 offset);
+    bool atEnd() const;
+
+    bool next();
+    qint64 messageOffset() const;
+    qint64 messageSize() const;
+    QByteArray envelope() const;
+    QByteArray rawMessage() const;
+    QByteArray messageData() const;
+    QxtMailMessage message(QxtMailMessage::ParseMode mode = QxtMailMessage::FullParse) const;
+
+private:
+    Q_DISABLE_COPY(QxtMailMbox)
+    Q_DECLARE_PRIVATE(QxtMailMbox)
+    QScopedPointer<QxtMailMboxPrivate> d_ptr;
+};
+
+#endif // MAILMBOX_H
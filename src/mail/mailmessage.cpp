@@ -38,55 +38,25 @@
  */
 
 
-#include "mailmessage.h"
-#include "mailutility_p.h"
-#include <QTextCodec>
+#include "mailmessage_p.h"
+#include "mailrfc2822parser_p.h"
 #include <QUuid>
 #include <QDir>
 #include <QtDebug>
 #include <QRegExp>
-
-//#define QXT_MAIL_MESSAGE_DEBUG 1
+#include <QCache>
+#include <QMutex>
+#include <QThreadStorage>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+#include <string.h>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MUST_QP(x) (x < char(32) || x > char(126) || x == '=' || x == '?')
 
-struct QxtMailMessagePrivate : public QSharedData
-{
-    QxtMailMessagePrivate() {}
-    QxtMailMessagePrivate(const QxtMailMessagePrivate& other)
-            : QSharedData(other), rcptTo(other.rcptTo), rcptCc(other.rcptCc), rcptBcc(other.rcptBcc),
-            subject(other.subject), body(other.body), sender(other.sender),
-            extraHeaders(other.extraHeaders), attachments(other.attachments),
-            wordWrapLimit(78), preserveStartSpaces(false) {}
-    QStringList rcptTo, rcptCc, rcptBcc;
-    QString subject, body, sender;
-    QHash<QString, QString> extraHeaders;
-    QHash<QString, QxtMailAttachment> attachments;
-    mutable QByteArray boundary;
-    int wordWrapLimit;
-    bool preserveStartSpaces;
-};
-
-class QxtRfc2822Parser
-{
-public:
-    QxtMailMessagePrivate* parse(const QByteArray& buffer);
-private:
-    enum State {
-        Headers,
-        Body
-    };
-    State state;
-    QString currentHeaderKey;
-    QStringList currentHeaderValue;
-    void parseHeader(const QByteArray& line, QHash<QString, QString>& headers);
-    void parseBody(QxtMailMessagePrivate* msg);
-    void parseEntity(const QByteArray& buffer, QHash<QString,QString>& headers, QString& body);
-    QxtMailAttachment* parseAttachment(const QHash<QString,QString>& headers, const QString& body, QString& filename);
-    QString unfoldValue(QStringList& folded);
-    QString decode(const QString& charset, const QString& encoding, const QString& encoded);
-};
-
 QxtMailMessage::QxtMailMessage()
 {
     qxt_d = new QxtMailMessagePrivate;
@@ -106,11 +76,27 @@ QxtMailMessage::QxtMailMessage(const QString& sender, const QString& recipient)
 
 /*!
   Constructs a new QxtMailMessage object from a \a buffer that conforms to RFC 2822 and the MIME related RFCs.
+
+  With the LazyParse \a mode, only the header section is indexed here. Header
+  fields are decoded the first time they are read, and the body and attachments
+  the first time one of them is read; the message keeps a shallow copy of
+  \a buffer until then. Modifying or rendering the message decodes everything.
   */
-QxtMailMessage::QxtMailMessage(const QByteArray& buffer)
+QxtMailMessage::QxtMailMessage(const QByteArray& buffer, ParseMode mode)
 {
-    QxtRfc2822Parser parser;
-    qxt_d = parser.parse(buffer);
+    if (mode == LazyParse)
+    {
+        QxtMailMessagePrivate* d = new QxtMailMessagePrivate;
+        d->parser.setBuffer(buffer);
+        d->parser.parseEntity(QxtMailSpan(0, buffer.size()), d->entity);
+        d->pending = QxtMailMessagePrivate::AllPending;
+        qxt_d = d;
+    }
+    else
+    {
+        QxtRfc2822Parser parser;
+        qxt_d = parser.parse(buffer);
+    }
 }
 
 QxtMailMessage::~QxtMailMessage()
@@ -132,6 +118,7 @@ QString QxtMailMessage::sender() const
 void QxtMailMessage::setSender(const QString& a)
 {
     qxt_d->sender = a;
+    qxt_d->rendered.clear();
 }
 
 QString QxtMailMessage::subject() const
@@ -142,16 +129,21 @@ QString QxtMailMessage::subject() const
 void QxtMailMessage::setSubject(const QString& a)
 {
     qxt_d->subject = a;
+    qxt_d->rendered.clear();
 }
 
 QString QxtMailMessage::body() const
 {
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->load(QxtMailMessagePrivate::BodyPending);
     return qxt_d->body;
 }
 
 void QxtMailMessage::setBody(const QString& a)
 {
+    qxt_d->unlinkSource();
     qxt_d->body = a;
+    qxt_d->rendered.clear();
 }
 
 QStringList QxtMailMessage::recipients(QxtMailMessage::RecipientType type) const
@@ -171,6 +163,7 @@ void QxtMailMessage::addRecipient(const QString& a, QxtMailMessage::RecipientTyp
         qxt_d->rcptCc.append(a);
     else
         qxt_d->rcptTo.append(a);
+    qxt_d->rendered.clear();
 }
 
 void QxtMailMessage::removeRecipient(const QString& a)
@@ -178,55 +171,68 @@ void QxtMailMessage::removeRecipient(const QString& a)
     qxt_d->rcptTo.removeAll(a);
     qxt_d->rcptCc.removeAll(a);
     qxt_d->rcptBcc.removeAll(a);
+    qxt_d->rendered.clear();
 }
 
 QHash<QString, QString> QxtMailMessage::extraHeaders() const
 {
-    return qxt_d->extraHeaders;
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->load(QxtMailMessagePrivate::HeadersPending);
+    return qxt_d->extraHeaders.toHash();
 }
 
 QString QxtMailMessage::extraHeader(const QString& key) const
 {
-    return qxt_d->extraHeaders[key.toLower()];
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->loadHeader(key);
+    return qxt_d->extraHeaders.value(key);
 }
 
 bool QxtMailMessage::hasExtraHeader(const QString& key) const
 {
-    return qxt_d->extraHeaders.contains(key.toLower());
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->loadHeader(key);
+    return qxt_d->extraHeaders.contains(key);
 }
 
 void QxtMailMessage::setExtraHeader(const QString& key, const QString& value)
 {
-    qxt_d->extraHeaders[key.toLower()] = value;
+    qxt_d->unlinkSource();
+    qxt_d->extraHeaders.set(key, value);
+    qxt_d->rendered.clear();
 }
 
 void QxtMailMessage::setExtraHeaders(const QHash<QString, QString>& a)
 {
-    QHash<QString, QString>& headers = qxt_d->extraHeaders;
-    headers.clear();
-    foreach(const QString& key, a.keys())
-    {
-        headers[key.toLower()] = a[key];
-    }
+    qxt_d->unlinkSource();
+    qxt_d->extraHeaders = QxtMailHeaders::fromHash(a);
+    qxt_d->rendered.clear();
 }
 
 void QxtMailMessage::removeExtraHeader(const QString& key)
 {
-    qxt_d->extraHeaders.remove(key.toLower());
+    qxt_d->unlinkSource();
+    qxt_d->extraHeaders.remove(key);
+    qxt_d->rendered.clear();
 }
 
 QHash<QString, QxtMailAttachment> QxtMailMessage::attachments() const
 {
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->load(QxtMailMessagePrivate::BodyPending);
     return qxt_d->attachments;
 }
 
 QxtMailAttachment QxtMailMessage::attachment(const QString& filename) const
 {
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->load(QxtMailMessagePrivate::BodyPending);
     return qxt_d->attachments[filename];
 }
 
 void QxtMailMessage::addAttachment(const QString& filename, const QxtMailAttachment& attach)
 {
+    qxt_d->unlinkSource();
     if (qxt_d->attachments.contains(filename))
     {
         qWarning() << "QxtMailMessage::addAttachment: " << filename << " already in use";
@@ -241,11 +247,35 @@ void QxtMailMessage::addAttachment(const QString& filename, const QxtMailAttachm
     {
         qxt_d->attachments[filename] = attach;
     }
+    qxt_d->rendered.clear();
 }
 
 void QxtMailMessage::removeAttachment(const QString& filename)
 {
+    qxt_d->unlinkSource();
     qxt_d->attachments.remove(filename);
+    qxt_d->rendered.clear();
+}
+
+/*!
+ * \brief Returns the root of the MIME part tree of the message, or a null part if there is none.
+ */
+QxtMailMimePart QxtMailMessage::rootPart() const
+{
+    return qxt_d->rootPart;
+}
+
+/*!
+ * \brief Sets \a part as the content of the message.
+ *
+ * When the message has a non-null root part, it is rendered instead of body() and
+ * attachments(). Parts keep their encoded form, so modifying or replacing a part of
+ * the tree only encodes that part again.
+ */
+void QxtMailMessage::setRootPart(const QxtMailMimePart& part)
+{
+    qxt_d->rootPart = part;
+    qxt_d->rendered.clear();
 }
 
 /*!
@@ -254,6 +284,7 @@ void QxtMailMessage::removeAttachment(const QString& filename)
 void QxtMailMessage::setWordWrapLimit(int limit)
 {
     qxt_d->wordWrapLimit = limit;
+    qxt_d->rendered.clear();
 }
 
 /*!
@@ -265,28 +296,206 @@ void QxtMailMessage::setWordWrapLimit(int limit)
 void QxtMailMessage::setWordWrapPreserveStartSpaces(bool state)
 {
     qxt_d->preserveStartSpaces = state;
+    qxt_d->rendered.clear();
+}
+
+static const char qxt_hex_digits[] = "0123456789ABCDEF";
+
+// Upper bound for the total size of the cached encoded-word headers, and for
+// the length of a single value worth caching.
+static const int QXT_ENCODED_WORD_CACHE_COST = 256 * 1024;
+static const int QXT_ENCODED_WORD_CACHE_MAX_VALUE = 2048;
+
+// Keeps the folded output of headers that needed RFC 2047 encoding, so that
+// the same subject or display name sent in a batch is only encoded once.
+// QCache evicts the least recently used entries when the cost is exceeded.
+class QxtEncodedWordCache
+{
+public:
+    QxtEncodedWordCache() : cache(QXT_ENCODED_WORD_CACHE_COST) {}
+
+    bool lookup(const QString& key, QByteArray& buffer)
+    {
+        QMutexLocker locker(&mutex);
+        const QByteArray* folded = cache.object(key);
+        if (!folded)
+            return false;
+        buffer += *folded;
+        return true;
+    }
+
+    void insert(const QString& key, const QByteArray& folded)
+    {
+        QMutexLocker locker(&mutex);
+        cache.insert(key, new QByteArray(folded), folded.size());
+    }
+
+private:
+    QMutex mutex;
+    QCache<QString, QByteArray> cache;
+};
+Q_GLOBAL_STATIC(QxtEncodedWordCache, qxt_encoded_word_cache)
+
+// lowercase names of the QxtMailHeaders ids
+static const char* const qxt_header_names[QxtMailHeaders::IdCount] = {
+    "", "from", "sender", "reply-to", "to", "cc", "bcc", "subject", "date", "message-id",
+    "mime-version", "content-type", "content-transfer-encoding", "content-disposition"
+};
+
+class QxtMailHeaderNames
+{
+public:
+    QxtMailHeaderNames()
+    {
+        for (int i = 0; i < QxtMailHeaders::IdCount; i++)
+            names[i] = QString::fromLatin1(qxt_header_names[i]);
+    }
+
+    // shared by all the headers, so that their keys are never allocated again
+    QString names[QxtMailHeaders::IdCount];
+};
+Q_GLOBAL_STATIC(QxtMailHeaderNames, qxt_header_name_strings)
+
+int QxtMailHeaders::idOf(const QString& name)
+{
+    const int length = name.length();
+    for (int i = 1; i < IdCount; i++)
+    {
+        const QLatin1String known(qxt_header_names[i]);
+        if (known.size() == length && name.compare(known, Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return Other;
+}
+
+int QxtMailHeaders::indexOf(const QString& name) const
+{
+    const int id = idOf(name);
+    if (id != Other)
+        return indexOf(Id(id));
+    for (int i = 0; i < fields.count(); i++)
+    {
+        const Field& field = fields.at(i);
+        if (field.id == Other && field.name.compare(name, Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int QxtMailHeaders::indexOf(Id id) const
+{
+    for (int i = 0; i < fields.count(); i++)
+    {
+        if (fields.at(i).id == id)
+            return i;
+    }
+    return -1;
+}
+
+QString QxtMailHeaders::value(const QString& name) const
+{
+    const int i = indexOf(name);
+    return i == -1 ? QString() : fields.at(i).value;
+}
+
+QString QxtMailHeaders::value(Id id) const
+{
+    const int i = indexOf(id);
+    return i == -1 ? QString() : fields.at(i).value;
 }
 
-QByteArray qxt_fold_mime_header(const QString& key, const QString& value, QTextCodec* latin1, const QByteArray& prefix)
+// replaces the value of the field named name, or appends a new field
+void QxtMailHeaders::set(const QString& name, const QString& value)
 {
-    QByteArray rv = "";
-    QByteArray line = key.toLatin1() + ": ";
-    if (!prefix.isEmpty()) line += prefix;
-    if (!value.contains(QStringLiteral("=?")) && latin1->canEncode(value))
+    const int i = indexOf(name);
+    if (i != -1)
     {
-        bool firstWord = true;
-        foreach(const QByteArray& word, value.toLatin1().split(' '))
+        fields[i].value = value;
+        return;
+    }
+    Field field;
+    field.id = idOf(name);
+    field.name = name;
+    field.value = value;
+    fields.append(field);
+}
+
+void QxtMailHeaders::remove(const QString& name)
+{
+    const int i = indexOf(name);
+    if (i != -1)
+        fields.remove(i);
+}
+
+// returns the fields keyed by their lowercase names
+QHash<QString, QString> QxtMailHeaders::toHash() const
+{
+    QHash<QString, QString> rv;
+    rv.reserve(fields.count());
+    foreach (const Field& field, fields)
+        rv.insert(field.id == Other ? field.name.toLower() : qxt_header_name_strings()->names[field.id], field.value);
+    return rv;
+}
+
+QxtMailHeaders QxtMailHeaders::fromHash(const QHash<QString, QString>& hash)
+{
+    QxtMailHeaders rv;
+    rv.fields.reserve(hash.count());
+    QHash<QString, QString>::const_iterator i;
+    for (i = hash.constBegin(); i != hash.constEnd(); ++i)
+        rv.set(i.key(), i.value());
+    return rv;
+}
+
+static bool qxt_is_latin1(const QString& value)
+{
+    const QChar* data = value.constData();
+    const int len = value.length();
+    for (int i = 0; i < len; i++)
+    {
+        if (data[i].unicode() > 0xff)
+            return false;
+    }
+    return true;
+}
+
+/*!
+  \internal
+  Appends the header field \a key with \a value to \a buffer, folded at word
+  boundaries or encoded as RFC 2047 encoded-words when the value isn't Latin-1.
+  \a prefix is emitted verbatim before the value.
+  */
+void qxt_fold_mime_header(QByteArray& buffer, const QString& key, const QString& value, const QByteArray& prefix)
+{
+    const bool encode = value.contains(QStringLiteral("=?")) || !qxt_is_latin1(value);
+    QString cacheKey;
+    if (encode && value.length() <= QXT_ENCODED_WORD_CACHE_MAX_VALUE)
+    {
+        // the folding depends on the column the value starts at, so the key
+        // and prefix are part of the cache key
+        cacheKey = key + QChar(0) + QString::fromLatin1(prefix) + QChar(0) + value;
+        if (qxt_encoded_word_cache()->lookup(cacheKey, buffer))
+            return;
+    }
+
+    const int headerStart = buffer.length();
+    int lineStart = headerStart;
+    qxt_append_latin1(buffer, key);
+    buffer += ": ";
+    buffer += prefix;
+    if (!encode)
+    {
+        const QChar* data = value.constData();
+        const int len = value.length();
+        for (int i = 0; i < len; i++)
         {
-            if (line.size() > 78)
+            const char ch = data[i].toLatin1();
+            if (ch == ' ' && buffer.length() - lineStart > 78)
             {
-                rv = rv + line + "\r\n";
-                line.clear();
+                buffer += "\r\n";
+                lineStart = buffer.length();
             }
-            if (firstWord)
-                line += word;
-            else
-                line += " " + word;
-            firstWord = false;
+            buffer += ch;
         }
     }
     else
@@ -295,7 +504,7 @@ QByteArray qxt_fold_mime_header(const QString& key, const QString& value, QTextC
         // must use quoted-printable or base64 encoding. This is a quick
         // heuristic based on the first 100 characters to see which
         // encoding to use.
-        QByteArray utf8 = value.toUtf8();
+        const QByteArray utf8 = value.toUtf8();
         int ct = utf8.length();
         int nonAscii = 0;
         for (int i = 0; i < ct && i < 100; i++)
@@ -305,596 +514,951 @@ QByteArray qxt_fold_mime_header(const QString& key, const QString& value, QTextC
         if (nonAscii > 20)
         {
             // more than 20%-ish non-ASCII characters: use base64
-            QByteArray base64 = utf8.toBase64();
+            const QByteArray base64 = utf8.toBase64();
+            const char* b = base64.constData();
             ct = base64.length();
-            line += "=?utf-8?b?";
+            buffer += "=?utf-8?b?";
             for (int i = 0; i < ct; i += 4)
             {
-                if (line.length() > 72)
+                if (buffer.length() - lineStart > 72)
                 {
-                    rv += line + "?=\r\n";
-                    line = " =?utf-8?b?";
+                    buffer += "?=\r\n";
+                    lineStart = buffer.length();
+                    buffer += " =?utf-8?b?";
                 }
-                line = line + base64.mid(i, 4);
+                buffer.append(b + i, qMin(4, ct - i));
             }
         }
         else
         {
             // otherwise use Q-encoding
-            line += "=?utf-8?q?";
+            const char* u = utf8.constData();
+            buffer += "=?utf-8?q?";
             for (int i = 0; i < ct; i++)
             {
-                if (line.length() > 73)
+                if (buffer.length() - lineStart > 73)
                 {
-                    rv += line + "?=\r\n";
-                    line = " =?utf-8?q?";
+                    buffer += "?=\r\n";
+                    lineStart = buffer.length();
+                    buffer += " =?utf-8?q?";
                 }
-                if (MUST_QP(utf8[i]) || utf8[i] == ' ')
+                if (MUST_QP(u[i]) || u[i] == ' ' || u[i] == '_')
                 {
-                    line += "=" + utf8.mid(i, 1).toHex().toUpper();
+                    const uchar ch = u[i];
+                    const char escaped[3] = { '=', qxt_hex_digits[ch >> 4], qxt_hex_digits[ch & 0xf] };
+                    buffer.append(escaped, 3);
                 }
                 else
                 {
-                    line += utf8[i];
+                    buffer += u[i];
                 }
             }
         }
-        line += "?="; // end encoded-word atom
+        buffer += "?="; // end encoded-word atom
     }
-    return rv + line + "\r\n";
+    buffer += "\r\n";
+
+    if (!cacheKey.isNull())
+        qxt_encoded_word_cache()->insert(cacheKey, buffer.mid(headerStart));
 }
 
-QByteArray QxtMailMessage::rfc2822() const
+/*!
+  \internal
+  Scans \a size bytes of \a data once and collects what is needed to pick a
+  transfer encoding: 8-bit and control characters, bytes that quoted-printable
+  has to escape, line endings and the longest line.
+  */
+QxtMailContentInfo qxt_analyze_content(const char* data, int size)
 {
-    // Use quoted-printable if requested
-    bool useQuotedPrintable = (extraHeader(QStringLiteral("Content-Transfer-Encoding")).toLower() == QLatin1String("quoted-printable"));
-    // Use base64 if requested
-    bool useBase64 = (extraHeader(QStringLiteral("Content-Transfer-Encoding")).toLower() == QLatin1String("base64"));
-    // Check to see if plain text is ASCII-clean; assume it isn't if QP or base64 was requested
-    QTextCodec* latin1 = QTextCodec::codecForName("latin1");
-    bool bodyIsAscii = latin1->canEncode(body()) && !useQuotedPrintable && !useBase64;
-
-    QHash<QString, QxtMailAttachment> attach = attachments();
-    QByteArray rv;
-
-    if (!sender().isEmpty() && !hasExtraHeader(QStringLiteral("From")))
+    QxtMailContentInfo info;
+    info.valid = true;
+    info.size = size;
+    int lineLength = 0;
+    int i = 0;
+    while (i < size)
     {
-        rv += qxt_fold_mime_header(QStringLiteral("From"), sender(), latin1);
+#ifdef __SSE2__
+        if (size - i >= 16)
+        {
+            // skip whole blocks of printable ASCII other than '=' and '?',
+            // which MUST_QP escapes; the others don't change anything but the
+            // line length
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(31)),
+                                                    _mm_cmplt_epi8(block, _mm_set1_epi8(127)));
+            const __m128i escaped = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('=')),
+                                                 _mm_cmpeq_epi8(block, _mm_set1_epi8('?')));
+            const __m128i plain = _mm_andnot_si128(escaped, printable);
+            uint mask = _mm_movemask_epi8(plain);
+            if (mask == 0xffff)
+            {
+                lineLength += 16;
+                i += 16;
+                continue;
+            }
+            while (mask & 1)
+            {
+                lineLength++;
+                i++;
+                mask >>= 1;
+            }
+        }
+#endif
+        const uchar ch = data[i];
+        if (ch == '\r' || ch == '\n')
+        {
+            if (ch == '\n')
+            {
+                info.bareLf++;
+            }
+            else if (i + 1 < size && data[i + 1] == '\n')
+            {
+                info.crlf++;
+                i++;
+            }
+            else
+            {
+                info.bareCr++;
+            }
+            if (lineLength > info.maxLineLength)
+                info.maxLineLength = lineLength;
+            lineLength = 0;
+            i++;
+            continue;
+        }
+        if (ch >= 0x80)
+        {
+            info.eightBit++;
+            info.qpEscapes++;
+        }
+        else if ((ch < 32 && ch != '\t') || ch == 127)
+        {
+            info.control++;
+            info.qpEscapes++;
+        }
+        else if (MUST_QP(char(ch)))
+        {
+            info.qpEscapes++;
+        }
+        lineLength++;
+        i++;
     }
+    if (lineLength > info.maxLineLength)
+        info.maxLineLength = lineLength;
+    return info;
+}
 
-    if (!qxt_d->rcptTo.isEmpty())
-    {
-        rv += qxt_fold_mime_header(QStringLiteral("To"), qxt_d->rcptTo.join(QStringLiteral(", ")), latin1);
-    }
+/*!
+  \internal
+  Returns the transfer encoding giving the smallest output for content described
+  by \a info. Line breaks of \a text content may be normalized, binary content
+  is always encoded as base64.
+  */
+QxtMailTransferEncoding qxt_choose_transfer_encoding(const QxtMailContentInfo& info, bool text)
+{
+    if (!text)
+        return QxtMailBase64;
+    if (info.isAscii() && info.maxLineLength <= 998)
+        return QxtMail7Bit;
+    // quoted-printable escapes take three bytes, and a soft line break is
+    // added every 73 output characters
+    const qint64 escaped = qint64(info.size) + 2 * qint64(info.qpEscapes);
+    const qint64 quotedPrintable = escaped + 3 * (escaped / 73);
+    const qint64 encoded = (qint64(info.size) + 2) / 3 * 4;
+    const qint64 base64 = encoded + 2 * (encoded / 76);
+    return quotedPrintable <= base64 ? QxtMailQuotedPrintable : QxtMailBase64;
+}
 
-    if (!qxt_d->rcptCc.isEmpty())
+const char* qxt_transfer_encoding_name(QxtMailTransferEncoding encoding)
+{
+    switch (encoding)
     {
-        rv += qxt_fold_mime_header(QStringLiteral("Cc"), qxt_d->rcptCc.join(QStringLiteral(", ")), latin1);
+    case QxtMail7Bit:
+        return "7bit";
+    case QxtMailQuotedPrintable:
+        return "quoted-printable";
+    default:
+        return "base64";
     }
+}
 
-    if (!subject().isEmpty())
+/*!
+  \internal
+  Appends \a data to \a buffer with its line breaks converted to CRLF and lines
+  starting with a dot stuffed.
+  */
+void qxt_encode_7bit(QByteArray& buffer, const char* data, int size)
+{
+    bool lineStart = true;
+    for (int i = 0; i < size; i++)
     {
-        rv += qxt_fold_mime_header(QStringLiteral("Subject"), subject(), latin1);
+        const char ch = data[i];
+        if (ch == '\r' || ch == '\n')
+        {
+            buffer += "\r\n";
+            if (ch == '\r' && i + 1 < size && data[i + 1] == '\n')
+                i++;
+            lineStart = true;
+            continue;
+        }
+        if (lineStart && ch == '.')
+            buffer += '.';
+        buffer += ch;
+        lineStart = false;
     }
+    if (!lineStart)
+        buffer += "\r\n";
+}
 
-    if (!bodyIsAscii)
+/*!
+  \internal
+  Appends \a data to \a buffer encoded as quoted-printable. Line breaks are kept
+  as hard line breaks, and a dot starting a line is escaped.
+  */
+void qxt_encode_quoted_printable(QByteArray& buffer, const char* data, int size)
+{
+    int lineStart = buffer.length();
+    for (int i = 0; i < size; i++)
     {
-        if (!hasExtraHeader(QStringLiteral("MIME-Version")) && !attach.count())
-            rv += "MIME-Version: 1.0\r\n";
-
-        // If no transfer encoding has been requested, guess.
-        // Heuristic: If >20% of the first 100 characters aren't
-        // 7-bit clean, use base64, otherwise use Q-P.
-        if(!bodyIsAscii && !useQuotedPrintable && !useBase64)
+        const char ch = data[i];
+        if (ch == '\r' || ch == '\n')
         {
-            QString b = body();
-            int nonAscii = 0;
-            int ct = b.length();
-            for (int i = 0; i < ct && i < 100; i++)
+            buffer += "\r\n";
+            lineStart = buffer.length();
+            if (ch == '\r' && i + 1 < size && data[i + 1] == '\n')
             {
-                if (MUST_QP(b[i])) nonAscii++;
+                // If we're looking at a CRLF pair, skip the second half
+                i++;
             }
-            useQuotedPrintable = !(nonAscii > 20);
-            useBase64 = !useQuotedPrintable;
+            continue;
         }
-    }
-
-    if (attach.count())
-    {
-        if (qxt_d->boundary.isEmpty())
-            qxt_d->boundary = QUuid::createUuid().toString().toLatin1().replace("{", "").replace("}", "");
-        if (!hasExtraHeader(QStringLiteral("MIME-Version")))
-            rv += "MIME-Version: 1.0\r\n";
-        if (!hasExtraHeader(QStringLiteral("Content-Type")))
-            rv += "Content-Type: multipart/mixed; boundary=" + qxt_d->boundary + "\r\n";
-    }
-    else if (!bodyIsAscii && !hasExtraHeader(QStringLiteral("Content-Transfer-Encoding")))
-    {
-        if (!useQuotedPrintable)
+        if (buffer.length() - lineStart > 72)
         {
-            // base64
-            rv += "Content-Transfer-Encoding: base64\r\n";
+            buffer += "=\r\n";
+            lineStart = buffer.length();
         }
-        else
+        const bool lineEnd = (i + 1 == size || data[i + 1] == '\r' || data[i + 1] == '\n');
+        if (MUST_QP(ch) || (ch == '.' && buffer.length() == lineStart) || (ch == ' ' && lineEnd))
         {
-            // quoted-printable
-            rv += "Content-Transfer-Encoding: quoted-printable\r\n";
+            const uchar c = ch;
+            const char escaped[3] = { '=', qxt_hex_digits[c >> 4], qxt_hex_digits[c & 0xf] };
+            buffer.append(escaped, 3);
         }
-    }
-
-    foreach(const QString& r, qxt_d->extraHeaders.keys())
-    {
-        if ((r.toLower() == QLatin1String("content-type") || r.toLower() == QLatin1String("content-transfer-encoding")) && attach.count())
+        else
         {
-            // Since we're in multipart mode, we'll be outputting this later
-            continue;
+            buffer += ch;
         }
-        rv += qxt_fold_mime_header(r, extraHeader(r), latin1);
     }
+    if (buffer.length() != lineStart)
+        buffer += "\r\n";
+}
 
-    rv += "\r\n";
-
-    if (attach.count())
+/*!
+  \internal
+  Appends \a data to \a buffer encoded as base64, in lines of 76 characters.
+  */
+void qxt_encode_base64(QByteArray& buffer, const char* data, int size)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uchar* d = reinterpret_cast<const uchar*>(data);
+    buffer.reserve(buffer.length() + (size + 2) / 3 * 4 + 2 * (size / 57 + 1));
+    for (int pos = 0; pos < size; pos += 57)
     {
-        // we're going to have attachments, so output the lead-in for the message body
-        rv += "This is a message with multiple parts in MIME format.\r\n";
-        rv += "--" + qxt_d->boundary + "\r\nContent-Type: ";
-        if (hasExtraHeader(QStringLiteral("Content-Type")))
-            rv += extraHeader(QStringLiteral("Content-Type")).toLatin1() + "\r\n";
-        else
-            rv += "text/plain; charset=UTF-8\r\n";
-        if (hasExtraHeader(QStringLiteral("Content-Transfer-Encoding")))
+        // 57 input bytes give a full line of 76 characters
+        const int end = qMin(pos + 57, size);
+        int i = pos;
+        for (; i + 2 < end; i += 3)
         {
-            rv += "Content-Transfer-Encoding: " + extraHeader(QStringLiteral("Content-Transfer-Encoding")).toLatin1() + "\r\n";
+            const char quad[4] = {
+                alphabet[d[i] >> 2],
+                alphabet[((d[i] & 0x03) << 4) | (d[i + 1] >> 4)],
+                alphabet[((d[i + 1] & 0x0f) << 2) | (d[i + 2] >> 6)],
+                alphabet[d[i + 2] & 0x3f]
+            };
+            buffer.append(quad, 4);
         }
-        else if (!bodyIsAscii)
+        if (i < end)
         {
-            if (!useQuotedPrintable)
-            {
-                // base64
-                rv += "Content-Transfer-Encoding: base64\r\n";
-            }
-            else
-            {
-                // quoted-printable
-                rv += "Content-Transfer-Encoding: quoted-printable\r\n";
-            }
+            const uint b1 = (i + 1 < end) ? d[i + 1] : 0;
+            const char quad[4] = {
+                alphabet[d[i] >> 2],
+                alphabet[((d[i] & 0x03) << 4) | (b1 >> 4)],
+                (i + 1 < end) ? alphabet[(b1 & 0x0f) << 2] : '=',
+                '='
+            };
+            buffer.append(quad, 4);
         }
-        rv += "\r\n";
+        buffer += "\r\n";
     }
+}
 
-    if (bodyIsAscii)
+/*!
+  \internal
+  Appends \a text to \a buffer encoded as UTF-8.
+  */
+void qxt_append_utf8(QByteArray& buffer, const QString& text)
+{
+    const ushort* u = text.utf16();
+    const int len = text.length();
+    for (int i = 0; i < len; i++)
     {
-        QByteArray b = latin1->fromUnicode(body());
-        int len = b.length();
-        QByteArray line;
-        QByteArray word;
-        QByteArray spaces;
-        QByteArray startSpaces;
-        for (int i = 0; i <= len; i++)
+        uint ch = u[i];
+        if (ch < 0x80)
         {
-            char ignoredChar = 0;
-            if (i != len) {
-                ignoredChar = b[i] == '\n'? '\r' : b[i] == '\r'? '\n' : 0;
-            }
-            if (!(ignoredChar || (i == len) || (b[i] == ' ') || (b[i] == '\t'))) {
-                // the char is part of word
-                if (word.isEmpty()) { // start of new word / end of spaces
-                    if (line.isEmpty()) {
-                        startSpaces = spaces;
-                    }
-                }
-                word += b[i];
-                continue;
-            }
-
-            // space char, so end of word or continuous spaces
-            if (!word.isEmpty()) { // start of new space area / end of word
-                if (line.length() + spaces.length() +
-                                        word.length() > qxt_d->wordWrapLimit) {
-                    // have to wrap word to next line
-                    if(line[0] == '.')
-                        rv += ".";
-                    rv += line + "\r\n";
-                    if (qxt_d->preserveStartSpaces) {
-                        line = startSpaces + word;
-                    } else {
-                        line = word;
-                    }
-                } else { // no wrap required
-                    line += spaces + word;
-                }
-                word.clear();
-                spaces.clear();
-            }
-
-            if (ignoredChar || i == len) { // new line or eof
-                // trailing `spaces` are ignored here
-                if(line[0] == '.')
-                    rv += ".";
-                rv += line + "\r\n";
-                line.clear();
-                startSpaces.clear();
-                spaces.clear();
-            } else {
-                spaces += b[i];
-            }
+            buffer += char(ch);
+            continue;
         }
-    }
-    else if (useQuotedPrintable)
-    {
-        QByteArray b = body().toUtf8();
-        int ct = b.length();
-        QByteArray line;
-        for (int i = 0; i < ct; i++)
+        if (QChar::isHighSurrogate(ch) && i + 1 < len && QChar::isLowSurrogate(u[i + 1]))
+            ch = QChar::surrogateToUcs4(ushort(ch), u[++i]);
+        else if (QChar::isSurrogate(ch))
+            ch = QChar::ReplacementCharacter;
+        char encoded[4];
+        int n;
+        if (ch < 0x800)
         {
-            if(b[i] == '\n' || b[i] == '\r')
-            {
-                if(line[0] == '.')
-                    rv += ".";
-                rv += line + "\r\n";
-                line = "";
-                if ((b[i+1] == '\n' || b[i+1] == '\r') && b[i] != b[i+1])
-                {
-                    // If we're looking at a CRLF pair, skip the second half
-                    i++;
-                }
-            }
-            else if (line.length() > 74)
-            {
-                rv += line + "=\r\n";
-                line = "";
-            }
-            if (MUST_QP(b[i]))
-            {
-                line += "=" + b.mid(i, 1).toHex().toUpper();
-            }
-            else
-            {
-                line += b[i];
-            }
+            encoded[0] = char(0xc0 | (ch >> 6));
+            encoded[1] = char(0x80 | (ch & 0x3f));
+            n = 2;
         }
-        if(!line.isEmpty()) {
-            if(line[0] == '.')
-                rv += ".";
-            rv += line + "\r\n";
+        else if (ch < 0x10000)
+        {
+            encoded[0] = char(0xe0 | (ch >> 12));
+            encoded[1] = char(0x80 | ((ch >> 6) & 0x3f));
+            encoded[2] = char(0x80 | (ch & 0x3f));
+            n = 3;
         }
-    }
-    else /* base64 */
-    {
-        QByteArray b = body().toUtf8().toBase64();
-        int ct = b.length();
-        for (int i = 0; i < ct; i += 78)
+        else
         {
-            rv += b.mid(i, 78) + "\r\n";
+            encoded[0] = char(0xf0 | (ch >> 18));
+            encoded[1] = char(0x80 | ((ch >> 12) & 0x3f));
+            encoded[2] = char(0x80 | ((ch >> 6) & 0x3f));
+            encoded[3] = char(0x80 | (ch & 0x3f));
+            n = 4;
         }
+        buffer.append(encoded, n);
     }
+}
+
+/*!
+  \internal
+  Appends the Latin-1 form of \a text to \a buffer.
+  */
+void qxt_append_latin1(QByteArray& buffer, const QString& text)
+{
+    const QChar* data = text.constData();
+    const int len = text.length();
+    for (int i = 0; i < len; i++)
+        buffer += data[i].toLatin1();
+}
 
-    if (attach.count())
+// returns data with its bare LF line breaks turned into CRLF; data itself if it has none
+QByteArray qxt_crlf_lines(const QByteArray& data)
+{
+    const char* src = data.constData();
+    const int size = data.size();
+    int bare = 0;
+    for (const char* p = src; (p = static_cast<const char*>(memchr(p, '\n', src + size - p))); p++)
     {
-        foreach(const QString& filename, attach.keys())
-        {
-            rv += "--" + qxt_d->boundary + "\r\n";
-            rv += qxt_fold_mime_header(QStringLiteral("Content-Disposition"), QDir(filename).dirName(), latin1, "attachment; filename=");
-            rv += attach[filename].mimeData();
-        }
-        rv += "--" + qxt_d->boundary + "--\r\n";
+        if (p == src || p[-1] != '\r')
+            bare++;
+    }
+    if (!bare)
+        return data;
+    QByteArray rv(size + bare, Qt::Uninitialized);
+    char* out = rv.data();
+    for (int i = 0; i < size; i++)
+    {
+        if (src[i] == '\n' && (i == 0 || src[i - 1] != '\r'))
+            *out++ = '\r';
+        *out++ = src[i];
     }
-
     return rv;
 }
 
+static void qxt_join(QString& buffer, const QStringList& list, const QString& separator)
+{
+    buffer.resize(0);
+    for (int i = 0; i < list.count(); i++)
+    {
+        if (i)
+            buffer += separator;
+        buffer += list.at(i);
+    }
+}
+
+// buffers of an arena grown past this size by an unusually large message are
+// released instead of being kept for the next one
+static const int QXT_ARENA_HIGH_WATER = 4 * 1024 * 1024;
+
+template <typename T>
+static void qxt_reset_buffer(T& buffer, int highWater)
+{
+    if (buffer.capacity() > highWater)
+    {
+        buffer = T();
+        return;
+    }
+    // a reserved capacity survives resize(0)
+    buffer.reserve(buffer.capacity());
+    buffer.resize(0);
+}
+
 /*!
-  Constructs a new QxtMailMessage object from a \a buffer that conforms to RFC 2822 and the MIME related RFCs.
+  \internal
+  Empties the buffers of the arena but keeps their memory for the next message,
+  unless a large message made them grow past a high-water mark.
   */
-QxtMailMessage QxtMailMessage::fromRfc2822(const QByteArray& buffer)
+void QxtMailRenderArena::reset()
 {
-    QxtMailMessage rv;
-    QxtRfc2822Parser parser;
-    rv.qxt_d = parser.parse(buffer);
-    return rv;
+    qxt_reset_buffer(output, QXT_ARENA_HIGH_WATER);
+    qxt_reset_buffer(bytes, QXT_ARENA_HIGH_WATER);
+    qxt_reset_buffer(text, QXT_ARENA_HIGH_WATER / int(sizeof(QChar)));
 }
 
-QxtMailMessagePrivate* QxtRfc2822Parser::parse(const QByteArray& buffer)
+// appends a run of body text to the current output line, stuffing a dot
+// that would start the line
+static void qxt_append_line_text(QByteArray& rv, int& lineLength, const char* data, int length)
 {
-    QxtMailMessagePrivate* rv = new QxtMailMessagePrivate();
-    parseEntity(buffer, rv->extraHeaders, rv->body);
-    parseBody(rv);
-    return rv;
+    if (!length)
+        return;
+    if (lineLength == 0 && data[0] == '.')
+        rv += '.';
+    rv.append(data, length);
+    lineLength += length;
 }
 
-void QxtRfc2822Parser::parseEntity(const QByteArray& buffer, QHash<QString,QString>& headers, QString& body)
+// word wraps ASCII text into rv; words and spaces are kept as ranges of the
+// source so that no temporary line buffers are needed
+static void qxt_wrap_ascii(QByteArray& rv, const char* b, int len, int wordWrapLimit, bool preserveStartSpaces)
 {
-    int pos = 0;
-    int crlfPos = 0;
-    QByteArray line;
-    currentHeaderKey = QString();
-    currentHeaderValue.clear();
-    state = Headers;
-    while (true)
+    int lineLength = 0;
+    int wordStart = 0, wordLength = 0;
+    int spacesStart = 0, spacesLength = 0;
+    int startSpacesStart = 0, startSpacesLength = 0;
+    for (int i = 0; i <= len; i++)
     {
-        crlfPos = buffer.indexOf("\r\n", pos);
-        if (crlfPos == -1)
-        {
-            break;
-        }
-        if (state == Headers && crlfPos == pos)  // double CRLF reached: end of headers section
-        {
-            state = Body;
-            parseHeader("", headers); // to store the header currently being parsed (last one)
-            pos += 2;
+        const bool lineBreak = (i != len) && (b[i] == '\n' || b[i] == '\r');
+        if (!(lineBreak || (i == len) || (b[i] == ' ') || (b[i] == '\t'))) {
+            // the char is part of word
+            if (wordLength == 0) { // start of new word / end of spaces
+                wordStart = i;
+                if (lineLength == 0) {
+                    startSpacesStart = spacesStart;
+                    startSpacesLength = spacesLength;
+                }
+            }
+            wordLength++;
             continue;
         }
-        line = buffer.mid(pos, crlfPos - pos);
-        pos = crlfPos + 2;
-        switch(state)
-        {
-        case Headers:
-            parseHeader(line, headers);
-            break;
-        case Body:
-            body.append(QString::fromLatin1(line + "\r\n"));
-            break;
-        default:
-            break;
+
+        // space char, so end of word or continuous spaces
+        if (wordLength) { // start of new space area / end of word
+            if (lineLength && lineLength + spacesLength + wordLength > wordWrapLimit) {
+                // have to wrap word to next line
+                rv += "\r\n";
+                lineLength = 0;
+                if (preserveStartSpaces)
+                    qxt_append_line_text(rv, lineLength, b + startSpacesStart, startSpacesLength);
+            } else { // no wrap required
+                qxt_append_line_text(rv, lineLength, b + spacesStart, spacesLength);
+            }
+            qxt_append_line_text(rv, lineLength, b + wordStart, wordLength);
+            wordLength = 0;
+            spacesLength = 0;
+        }
+
+        if (lineBreak || i == len) { // new line or eof
+            // trailing spaces are ignored here
+            rv += "\r\n";
+            lineLength = 0;
+            startSpacesLength = 0;
+            spacesLength = 0;
+            if (lineBreak && b[i] == '\r' && i + 1 < len && b[i + 1] == '\n')
+                i++; // a CRLF pair is a single line break
+        } else {
+            if (spacesLength == 0)
+                spacesStart = i;
+            spacesLength++;
         }
     }
 }
 
-void QxtRfc2822Parser::parseHeader(const QByteArray& line, QHash<QString, QString>& headers )
+static void qxt_append_content_transfer_encoding(QByteArray& rv, bool useQuotedPrintable)
 {
-    QRegExp spRe(QStringLiteral("^[ \\t]"));
-    QRegExp hdrRe(QStringLiteral("^([!-9;-~]+):[ \\t](.*)$"));
-    QString lineStr = QString::fromLatin1(line);
-    if (spRe.indexIn(lineStr) == 0) // continuation line
+    if (!useQuotedPrintable)
     {
-        currentHeaderValue.append(lineStr);
+        // base64
+        rv += "Content-Transfer-Encoding: base64\r\n";
     }
     else
     {
-        // starting a new header field. Store the current one before
-        if (!currentHeaderKey.isEmpty())
-        {
-            QString value = unfoldValue(currentHeaderValue);
-            headers[currentHeaderKey.toLower()] = value;
-            currentHeaderKey = QString();
-            currentHeaderValue.clear();
-        }
-        if (hdrRe.exactMatch(lineStr))
-        {
-            currentHeaderKey = hdrRe.cap(1);
-            currentHeaderValue.append(hdrRe.cap(2));
-        } // else: empty or malformed header line. Ignore.
+        // quoted-printable
+        rv += "Content-Transfer-Encoding: quoted-printable\r\n";
     }
 }
 
-// extract the attachments from a multipart body
-// proceed only one level deep
-// future plans may involve nested parts and dealing with inline parts too
-void QxtRfc2822Parser::parseBody(QxtMailMessagePrivate* msg)
+/*!
+  \internal
+  Renders the message into the output buffer of \a arena. The other buffers of
+  the arena are used as scratch space, so that rendering a message makes next to
+  no heap allocations once the arena has grown to the size of the messages.
+  */
+void QxtMailMessagePrivate::render(QxtMailRenderArena& arena) const
 {
-    QString& body = msg->body;
-    if (!msg->extraHeaders.contains(QStringLiteral("content-type"))) return;
-    QString contentType = msg->extraHeaders[QStringLiteral("content-type")];
-    if (!contentType.indexOf(QStringLiteral("multipart"), 0, Qt::CaseInsensitive) == 0) return;
-    // extract the boundary delimiter
-    QRegExp boundaryRe(QStringLiteral("boundary=\"?([^\"]*)\"?(?=;|$)"));
-    if (boundaryRe.indexIn(contentType) == -1)
+    if (rootPart.type() != QxtMailMimePart::Null)
     {
-        qDebug("Boundary regexp didn't match for %s", contentType.toLatin1().data());
+        renderTree(arena);
         return;
     }
-    QString boundary = boundaryRe.cap(1);
-//    qDebug("Boundary=%s", boundary.toLatin1().data());
-    QRegExp bndRe(QStringLiteral("(^|\\r?\\n)--%1(--)?[ \\t]*\\r?\\n").arg(QRegExp::escape(boundary)));   // find boundary delimiters in the body
-//    qDebug("search for %s", bndRe.pattern().toLatin1().data());
-    if (!bndRe.isValid())
+
+    const QString transferEncoding = extraHeaders.value(QxtMailHeaders::ContentTransferEncoding);
+    // Use quoted-printable if requested
+    bool useQuotedPrintable = (transferEncoding.compare(QLatin1String("quoted-printable"), Qt::CaseInsensitive) == 0);
+    // Use base64 if requested
+    bool useBase64 = (transferEncoding.compare(QLatin1String("base64"), Qt::CaseInsensitive) == 0);
+    // Check to see if plain text is ASCII-clean; assume it isn't if QP or base64 was requested
+    QByteArray& bodyData = arena.bytes;
+    qxt_append_utf8(bodyData, body);
+    const QxtMailContentInfo bodyInfo = qxt_analyze_content(bodyData.constData(), bodyData.length());
+    bool bodyIsAscii = bodyInfo.isAscii() && !useQuotedPrintable && !useBase64;
+
+    const bool multipart = !attachments.isEmpty();
+    QByteArray& rv = arena.output;
+
+    if (!sender.isEmpty() && !extraHeaders.contains(QxtMailHeaders::From))
+    {
+        qxt_fold_mime_header(rv, QStringLiteral("From"), sender);
+    }
+
+    if (!rcptTo.isEmpty())
     {
-        qDebug("regexp %s not valid ! %s", bndRe.pattern().toLatin1().data(), bndRe.errorString().toLatin1().data());
+        qxt_join(arena.text, rcptTo, QStringLiteral(", "));
+        qxt_fold_mime_header(rv, QStringLiteral("To"), arena.text);
     }
-#ifdef QXT_MAIL_MESSAGE_DEBUG
-    bool last = false;
-#endif
-    // keep track of the position of two consecutive boundary delimiters:
-    // begin* is the position of the delimiter first character,
-    // end* is the position of the first character of the part following it.
-    int beginFirst = 0;
-    int endFirst = 0;
-    int beginSecond = 0;
-    int endSecond = 0;
-    while(bndRe.indexIn(body, endSecond) != -1)
-    {
-        beginSecond = bndRe.pos() + bndRe.cap(1).length(); // add length of preceding line break, if any
-        endSecond = bndRe.pos() + bndRe.matchedLength();
-#ifdef QXT_MAIL_MESSAGE_DEBUG
-#if QT_VERSION >= 0x040600
-        if (bndRe.captureCount() == 2 && bndRe.cap(2) == "--") last = true;
-#else
-        if (bndRe.numCaptures() == 2 && bndRe.cap(2) == "--") last = true;
-#endif
-#endif
 
-//        qDebug("found%s boundary delimiter at position %d.", last?" last":"", beginSecond);
-//        qDebug("%d captures", bndRe.numCaptures());
-//        foreach(QString capture, bndRe.capturedTexts())
-//        {
-//            qDebug("->%s<-", capture.toLatin1().data());
-//        }
-//        qDebug("beginFirst = %d\nendFirst = %d\nbeginSecond = %d\nendSecond = %d", beginFirst, endFirst, beginSecond, endSecond);
-        if (endFirst != 0)
+    if (!rcptCc.isEmpty())
+    {
+        qxt_join(arena.text, rcptCc, QStringLiteral(", "));
+        qxt_fold_mime_header(rv, QStringLiteral("Cc"), arena.text);
+    }
+
+    if (!subject.isEmpty())
+    {
+        qxt_fold_mime_header(rv, QStringLiteral("Subject"), subject);
+    }
+
+    if (!bodyIsAscii)
+    {
+        if (!extraHeaders.contains(QxtMailHeaders::MimeVersion) && !multipart)
+            rv += "MIME-Version: 1.0\r\n";
+
+        // If no transfer encoding has been requested, use the one with
+        // the smaller predicted output.
+        if(!bodyIsAscii && !useQuotedPrintable && !useBase64)
         {
-            // handle part here:
-            QByteArray part = body.mid(endFirst, beginSecond - endFirst).toLocal8Bit();
-            QHash<QString,QString> partHeaders;
-            QString partBody;
-            parseEntity(part, partHeaders, partBody);
-//            qDebug("Part headers:");
-//            foreach (QString key, partHeaders.keys())
-//            {
-//                qDebug("%s: %s", key.toLatin1().data(), partHeaders[key].toLatin1().data());
-//            }
-//            qDebug("Part body:\n%s", partBody.toLatin1().data());
-            if (partHeaders.contains(QStringLiteral("content-disposition")) && partHeaders[QStringLiteral("content-disposition")].indexOf(QStringLiteral("attachment;")) == 0)
-            {
-//                qDebug("Attachment!");
-                QString filename;
-                QxtMailAttachment* attachment = parseAttachment(partHeaders, partBody, filename);
-                if (attachment)
-                {
-                    msg->attachments.insert(filename, *attachment);
-                    delete attachment;
-                }
-                // strip part from body
-                body.replace(beginFirst, beginSecond - beginFirst, QStringLiteral(""));
-                beginSecond = beginFirst;
-                endSecond = endFirst;
-            }
+            useQuotedPrintable = (qxt_choose_transfer_encoding(bodyInfo, true) != QxtMailBase64);
+            useBase64 = !useQuotedPrintable;
         }
-        beginFirst = beginSecond;
-        endFirst = endSecond;
     }
-}
 
-QString QxtRfc2822Parser::unfoldValue(QStringList& folded)
-{
-    QString unfolded;
-    QRegExp encRe(QStringLiteral("=\\?([^? \\t]+)\\?([qQbB])\\?([^? \\t]+)\\?=")); // search for an encoded word
-    QStringList::iterator i;
-    for (i = folded.begin(); i != folded.end(); ++i)
+    if (multipart)
     {
-        int offset = 0;
-        while (encRe.indexIn(*i, offset) != -1)
+        if (boundary.isEmpty())
+            boundary = QUuid::createUuid().toString().toLatin1().replace("{", "").replace("}", "");
+        if (!extraHeaders.contains(QxtMailHeaders::MimeVersion))
+            rv += "MIME-Version: 1.0\r\n";
+        if (!extraHeaders.contains(QxtMailHeaders::ContentType))
         {
-            QString decoded = decode(encRe.cap(1), encRe.cap(2).toLower(), encRe.cap(3));
-            i->replace(encRe.pos(), encRe.matchedLength(), decoded);  // replace encoded word with decoded one
-            offset = encRe.pos() + decoded.length(); // set offset after the inserted decoded word
+            rv += "Content-Type: multipart/mixed; boundary=";
+            rv += boundary;
+            rv += "\r\n";
         }
     }
-    unfolded = folded.join(QString());
-    return unfolded;
-}
+    else if (!bodyIsAscii && !extraHeaders.contains(QxtMailHeaders::ContentTransferEncoding))
+    {
+        if (!extraHeaders.contains(QxtMailHeaders::ContentType))
+            rv += "Content-Type: text/plain; charset=UTF-8\r\n";
+        qxt_append_content_transfer_encoding(rv, useQuotedPrintable);
+    }
 
-QString QxtRfc2822Parser::decode(const QString& charset, const QString& encoding, const QString& encoded)
-{
-    QString rv;
-    QByteArray buf;
-    if (encoding == QLatin1String("q"))
+    for (int i = 0; i < extraHeaders.count(); i++)
     {
-        QByteArray src = encoded.toLatin1();
-        int len = src.length();
-        for (int i = 0; i < len; i++)
+        const int id = extraHeaders.id(i);
+        if ((id == QxtMailHeaders::ContentType || id == QxtMailHeaders::ContentTransferEncoding) && multipart)
         {
-            if (src[i] == '_')
-            {
-                buf += 0x20;
-            }
-            else if (src[i] == '=')
-            {
-                if (i+2 < len)
-                {
-                    buf += QByteArray::fromHex(src.mid(i+1,2));
-                    i += 2;
-                }
-            }
-            else
-            {
-                buf += src[i];
-            }
+            // Since we're in multipart mode, we'll be outputting this later
+            continue;
         }
+        qxt_fold_mime_header(rv, extraHeaders.name(i), extraHeaders.value(i));
     }
-    else if (encoding == QLatin1String("b"))
+
+    rv += "\r\n";
+
+    if (multipart)
     {
-        buf = QByteArray::fromBase64(encoded.toLatin1());
+        // we're going to have attachments, so output the lead-in for the message body
+        rv += "This is a message with multiple parts in MIME format.\r\n";
+        rv += "--";
+        rv += boundary;
+        rv += "\r\nContent-Type: ";
+        if (extraHeaders.contains(QxtMailHeaders::ContentType))
+            qxt_append_latin1(rv, extraHeaders.value(QxtMailHeaders::ContentType));
+        else
+            rv += "text/plain; charset=UTF-8";
+        rv += "\r\n";
+        if (!transferEncoding.isEmpty())
+        {
+            rv += "Content-Transfer-Encoding: ";
+            qxt_append_latin1(rv, transferEncoding);
+            rv += "\r\n";
+        }
+        else if (!bodyIsAscii)
+        {
+            qxt_append_content_transfer_encoding(rv, useQuotedPrintable);
+        }
+        rv += "\r\n";
     }
-    QTextCodec *codec = QTextCodec::codecForName(charset.toLatin1());
-    if (codec)
+
+    if (bodyIsAscii)
     {
-        rv = codec->toUnicode(buf);
+        qxt_wrap_ascii(rv, bodyData.constData(), bodyData.length(), wordWrapLimit, preserveStartSpaces);
+    }
+    else if (useQuotedPrintable)
+    {
+        qxt_encode_quoted_printable(rv, bodyData.constData(), bodyData.length());
+    }
+    else /* base64 */
+    {
+        qxt_encode_base64(rv, bodyData.constData(), bodyData.length());
+    }
+
+    if (multipart)
+    {
+        QHash<QString, QxtMailAttachment>::const_iterator attachment;
+        for (attachment = attachments.constBegin(); attachment != attachments.constEnd(); ++attachment)
+        {
+            rv += "--";
+            rv += boundary;
+            rv += "\r\n";
+            const QString& filename = attachment.key();
+            const int slash = qMax(filename.lastIndexOf(QLatin1Char('/')), filename.lastIndexOf(QLatin1Char('\\')));
+            qxt_fold_mime_header(rv, QStringLiteral("Content-Disposition"), slash < 0 ? filename : filename.mid(slash + 1), QByteArrayLiteral("attachment; filename="));
+            attachment.value().appendMimeData(rv);
+        }
+        rv += "--";
+        rv += boundary;
+        rv += "--\r\n";
     }
-    return rv;
 }
 
-QxtMailAttachment* QxtRfc2822Parser::parseAttachment(const QHash<QString,QString>& headers, const QString& body, QString& filename)
+// renders the header fields of the message followed by its MIME part tree
+void QxtMailMessagePrivate::renderTree(QxtMailRenderArena& arena) const
 {
-    static int count = 1;
-    QByteArray content;
-    QRegExp filenameRe(QStringLiteral(";\\s+filename=\"?([^\"]*)\"?(?=;|$)"));
-    if (filenameRe.indexIn(headers[QStringLiteral("content-disposition")]) != -1)
+    QByteArray& rv = arena.output;
+    if (!sender.isEmpty() && !extraHeaders.contains(QxtMailHeaders::From))
+        qxt_fold_mime_header(rv, QStringLiteral("From"), sender);
+    if (!rcptTo.isEmpty())
     {
-        filename = filenameRe.cap(1);
+        qxt_join(arena.text, rcptTo, QStringLiteral(", "));
+        qxt_fold_mime_header(rv, QStringLiteral("To"), arena.text);
     }
-    else
+    if (!rcptCc.isEmpty())
+    {
+        qxt_join(arena.text, rcptCc, QStringLiteral(", "));
+        qxt_fold_mime_header(rv, QStringLiteral("Cc"), arena.text);
+    }
+    if (!subject.isEmpty())
+        qxt_fold_mime_header(rv, QStringLiteral("Subject"), subject);
+    if (!extraHeaders.contains(QxtMailHeaders::MimeVersion))
+        rv += "MIME-Version: 1.0\r\n";
+    for (int i = 0; i < extraHeaders.count(); i++)
     {
-        filename = QStringLiteral("attachment%1").arg(count);
+        // the content header fields come from the root part
+        const int id = extraHeaders.id(i);
+        if (id == QxtMailHeaders::ContentType || id == QxtMailHeaders::ContentTransferEncoding)
+            continue;
+        qxt_fold_mime_header(rv, extraHeaders.name(i), extraHeaders.value(i));
     }
-//    qDebug("Attachment %s", filename.toLocal8Bit().data());
+    rootPart.appendMimeData(rv);
+}
 
-    QString ct;
-    if (headers.contains(QStringLiteral("content-type")))
+void QxtMailMessage::render(QxtMailRenderArena& arena) const
+{
     {
-        ct = headers[QStringLiteral("content-type")];
+        QMutexLocker locker(&qxt_d->parseMutex);
+        qxt_d->load(QxtMailMessagePrivate::AllPending);
+    }
+    QMutexLocker locker(&qxt_d->renderMutex);
+    if (qxt_d->rendered.isNull())
+    {
+        const int start = arena.output.size();
+        qxt_d->render(arena);
+        // cached like rfc2822() does, so that a retry doesn't encode the message
+        // again; copied so that the arena keeps its buffer for the next message
+        qxt_d->rendered = QByteArray(arena.output.constData() + start, arena.output.size() - start);
     }
     else
     {
-        ct = QStringLiteral("application/octet-stream");
+        arena.output += qxt_d->rendered;
     }
+}
+
+/*!
+  Returns the message serialized according to RFC 2822 and the MIME related RFCs.
 
-    QString cte;
-    if (headers.contains(QStringLiteral("content-transfer-encoding")))
+  The result is cached and reused until the message is modified through one of its
+  setters; copies sharing the same data share the cached result too. Changes made
+  directly to the QIODevice of an attachment are not detected.
+  */
+QByteArray QxtMailMessage::rfc2822() const
+{
     {
-        cte = headers[QStringLiteral("content-transfer-encoding")].toLower();
-//        qDebug("Content-Transfer-Encoding: %s", cte.toLatin1().data());
+        QMutexLocker locker(&qxt_d->parseMutex);
+        qxt_d->load(QxtMailMessagePrivate::AllPending);
     }
-    if ( cte == QLatin1String("base64"))
+    QMutexLocker locker(&qxt_d->renderMutex);
+    if (qxt_d->rendered.isNull())
     {
-        content = QByteArray::fromBase64(body.toLatin1());
+        QxtMailRenderArena arena;
+        qxt_d->render(arena);
+        qxt_d->rendered = arena.output;
     }
-    else if (cte == QStringLiteral("quoted-printable"))
+    return qxt_d->rendered;
+}
+
+/*!
+  Constructs a new QxtMailMessage object from a \a buffer that conforms to RFC 2822 and the MIME related RFCs.
+
+  \sa QxtMailMessage(const QByteArray&, ParseMode)
+  */
+QxtMailMessage QxtMailMessage::fromRfc2822(const QByteArray& buffer, ParseMode mode)
+{
+    return QxtMailMessage(buffer, mode);
+}
+
+static void qxt_parse_messages(const QList<QByteArray>* buffers, QxtMailMessage* messages, int begin, int end,
+                               QxtMailMessage::ParseMode mode)
+{
+    for (int i = begin; i < end; i++)
+        new (messages + i) QxtMailMessage(buffers->at(i), mode);
+}
+
+/*!
+  Parses each of the \a buffers like fromRfc2822(const QByteArray&, ParseMode)
+  and returns the messages in the order of the buffers.
+
+  The buffers are parsed in parallel on \a pool, or on the global thread pool if
+  \a pool is null. Small messages are handed out in batches so that scheduling
+  doesn't outweigh parsing, and the calling thread takes part in the work.
+  */
+QList<QxtMailMessage> QxtMailMessage::fromRfc2822(const QList<QByteArray>& buffers, ParseMode mode, QThreadPool* pool)
+{
+    if (!pool)
+        pool = QThreadPool::globalInstance();
+    const int count = buffers.count();
+    // raw storage: the tasks construct each message in its place, rather than
+    // assigning over a default message built for nothing
+    QxtMailMessage* results = static_cast<QxtMailMessage*>(::operator new(count * sizeof(QxtMailMessage)));
+
+    qint64 total = 0;
+    foreach (const QByteArray& buffer, buffers)
+        total += buffer.size();
+    // a few batches per thread even out the cost of uneven messages
+    const int threads = qMax(1, pool->maxThreadCount());
+    const qint64 batchSize = qBound(Q_INT64_C(16384), total / (threads * 4), Q_INT64_C(1048576));
+
+    QList<QFuture<void> > tasks;
+    int begin = 0;
+    qint64 size = 0;
+    for (int i = 0; i < count; i++)
     {
-        QByteArray src = body.toLatin1();
-        int len = src.length();
-        QTextStream dest(&content);
-        for (int i = 0; i < len; i++)
+        size += buffers.at(i).size();
+        if (size < batchSize && i + 1 < count)
+            continue;
+        if (i + 1 == count)
         {
-            if (src.mid(i,2) == "\r\n")
-            {
-                dest << endl;
-                i++;
-            }
-            else if (src[i] == '=')
-            {
-                if (i+2 < len)
-                {
-                    if (src.mid(i+1,2) == "\r\n") // soft line break; skip
-                    {
-                        i +=2;
-                    }
-                    else
-                    {
-                        dest << QByteArray::fromHex(src.mid(i+1,2));
-                        i += 2;
-                    }
-                }
-            }
-            else
+            qxt_parse_messages(&buffers, results, begin, count, mode);
+            break;
+        }
+        tasks.append(QtConcurrent::run(pool, qxt_parse_messages, &buffers, results, begin, i + 1, mode));
+        begin = i + 1;
+        size = 0;
+    }
+    foreach (QFuture<void> task, tasks)
+        task.waitForFinished();
+    QList<QxtMailMessage> messages;
+    messages.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        messages.append(results[i]);
+        results[i].~QxtMailMessage();
+    }
+    ::operator delete(results);
+    return messages;
+}
+
+/*!
+  Returns the header fields of the message held in \a buffer, keyed by their
+  lowercase names like extraHeaders(), without building a QxtMailMessage. The
+  scan stops at the end of the header section. If \a fields isn't empty, only
+  the fields named in it are decoded and returned.
+
+  This is meant for listing many messages: each thread reuses the same
+  tokenizer state from one call to the next.
+  */
+QHash<QString, QString> QxtMailMessage::scanHeaders(const QByteArray& buffer, const QStringList& fields)
+{
+    static QThreadStorage<QxtRfc2822Entity> entities;
+    QxtRfc2822Entity& entity = entities.localData();
+    QxtRfc2822Parser parser;
+    parser.setBuffer(buffer);
+    parser.parseEntity(QxtMailSpan(0, buffer.size()), entity);
+    QHash<QString, QString> rv;
+    if (fields.isEmpty())
+    {
+        foreach (const QxtRfc2822Field& field, entity.fields)
+            rv.insert(parser.fieldName(field).toLower(), parser.fieldValue(field));
+        return rv;
+    }
+    QStringList wanted;
+    foreach (const QString& name, fields)
+        wanted.append(name.toLower());
+    foreach (const QxtRfc2822Field& field, entity.fields)
+    {
+        foreach (const QString& name, wanted)
+        {
+            if (parser.fieldNameIs(field, name))
             {
-                dest << src[i];
+                rv.insert(name, parser.fieldValue(field));
+                break;
             }
         }
     }
-    else // assume 7bit or 8bit
+    return rv;
+}
+
+// Decodes the last header field named key if the header fields are still pending.
+void QxtMailMessagePrivate::loadHeader(const QString& key) const
+{
+    if (!(pending & HeadersPending) || extraHeaders.contains(key))
+        return;
+    const QString lower = key.toLower();
+    for (int i = entity.fields.count() - 1; i >= 0; i--)
     {
-        content = body.toLocal8Bit();
-        if (isTextMedia(ct))
+        const QxtRfc2822Field& field = entity.fields.at(i);
+        if (parser.fieldNameIs(field, lower))
         {
-            content.replace("\r\n","\n");
+            extraHeaders.set(parser.fieldName(field), parser.fieldValue(field));
+            return;
         }
     }
-    QxtMailAttachment* rv = new QxtMailAttachment(content, ct);
-    rv->setExtraHeaders(headers);
+}
+
+void QxtMailMessagePrivate::load(int parts) const
+{
+    // the body is built from the parts, and needs the Content-Type of the message
+    if (parts & BodyPending)
+        parts |= HeadersPending | PartsPending;
+    parts &= pending;
+    if (!parts)
+        return;
+    // the decoded parts are caches of the source, hence filled in const accessors
+    QxtMailMessagePrivate* self = const_cast<QxtMailMessagePrivate*>(this);
+    if (parts & PartsPending)
+        parser.parseTree(entity.span, entity);
+    if (parts & HeadersPending)
+        self->extraHeaders = parser.fieldHeaders(entity);
+    if (parts & BodyPending)
+        parser.parseBody(self, entity);
+    pending &= ~parts;
+}
+
+// Called before the parsed content is modified: decodes everything, and drops
+// the source that doesn't match the message anymore.
+void QxtMailMessagePrivate::unlinkSource()
+{
+    load(AllPending);
+    parser = QxtRfc2822Parser();
+    entity = QxtRfc2822Entity();
+}
+
+// Returns the bytes the message was parsed from, or a null array if it was built
+// or changed since. Changing the header fields, the body or the attachments drops
+// the source; the other setters fill fields that parsing leaves empty.
+QByteArray QxtMailMessagePrivate::source() const
+{
+    if (!sender.isEmpty() || !subject.isEmpty() || !rcptTo.isEmpty() || !rcptCc.isEmpty() || !rcptBcc.isEmpty()
+        || rootPart.type() != QxtMailMimePart::Null)
+        return QByteArray();
+    QMutexLocker locker(&parseMutex);
+    return parser.buffer();
+}
+
+// Returns the entity at path in the index of the source, or 0.
+const QxtRfc2822Entity* QxtMailMessagePrivate::findPart(const QString& path) const
+{
+    if (parser.buffer().isNull())
+        return 0;
+    const QxtRfc2822Entity* rv = &entity;
+    if (path.isEmpty())
+        return rv;
+    foreach (const QString& number, path.split(QLatin1Char('.')))
+    {
+        bool ok;
+        const int index = number.toInt(&ok) - 1;
+        if (!ok || index < 0 || index >= rv->parts.count())
+            return 0;
+        rv = &rv->parts.at(index);
+    }
     return rv;
 }
 
+/*!
+  Returns the number of parts of the multipart entity at \a path, or 0 if it
+  isn't a multipart or if the message has no source to index, as described
+  for part().
+
+  \sa part()
+  */
+int QxtMailMessage::partCount(const QString& path) const
+{
+    QMutexLocker locker(&qxt_d->parseMutex);
+    qxt_d->load(QxtMailMessagePrivate::PartsPending);
+    const QxtRfc2822Entity* entity = qxt_d->findPart(path);
+    return entity ? entity->parts.count() : 0;
+}
+
+/*!
+  Returns the MIME part at \a path of a message built from RFC 2822 data,
+  nested parts included, decoding only that part. \a path is made of the
+  1-based indexes of the parts separated by dots, like the section numbers of
+  IMAP: "2.1" is the first part of the second part of the message. An empty
+  \a path gives the whole content of the message.
+
+  A multipart entity is returned as a container part, and any other entity as
+  an attachment part holding its decoded content, with the header fields of
+  the entity. The part is only given a filename when the entity has an
+  attachment disposition naming one. A null part is returned if there is no
+  part at \a path, or if the body, the header fields or the
+  attachments of the message were modified since it was parsed.
+
+  Parts are decoded from the RFC 2822 data the message was built from. A
+  message retrieved by a QxtPop3RetrReply only keeps that data if
+  QxtPop3RetrReply::setKeepRawMessage() was enabled. When the message has no
+  such data, a warning is printed and a null part is returned.
+  */
+QxtMailMimePart QxtMailMessage::part(const QString& path) const
+{
+    QMutexLocker locker(&qxt_d->parseMutex);
+    if (qxt_d->parser.buffer().isNull())
+    {
+        qWarning("QxtMailMessage::part(): Message has no RFC 2822 source to decode parts from");
+        return QxtMailMimePart();
+    }
+    qxt_d->load(QxtMailMessagePrivate::PartsPending);
+    const QxtRfc2822Entity* entity = qxt_d->findPart(path);
+    return entity ? qxt_d->parser.decodePart(*entity) : QxtMailMimePart();
+}
 
 // gives only a hint, based on content-type value.
 // takes value of Content-Type header field as parameter
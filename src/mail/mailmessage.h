@@ -34,13 +34,17 @@
 
 #include "mailglobal.h"
 #include "mailattachment.h"
+#include "mailmimepart.h"
 
 #include <QStringList>
 #include <QHash>
 #include <QMetaType>
 #include <QSharedDataPointer>
 
+class QThreadPool;
+
 struct QxtMailMessagePrivate;
+class QxtMailRenderArena;
 class Q_MAIL_EXPORT QxtMailMessage
 {
 public:
@@ -51,10 +55,16 @@ public:
         Bcc
     };
 
+    enum ParseMode
+    {
+        FullParse,
+        LazyParse
+    };
+
     QxtMailMessage();
     QxtMailMessage(const QxtMailMessage& other);
     QxtMailMessage(const QString& sender, const QString& recipient);
-    QxtMailMessage(const QByteArray& rfc2822);
+    QxtMailMessage(const QByteArray& rfc2822, ParseMode mode = FullParse);
     QxtMailMessage& operator=(const QxtMailMessage& other);
     ~QxtMailMessage();
 
@@ -83,13 +93,27 @@ public:
     void addAttachment(const QString& filename, const QxtMailAttachment& attach);
     void removeAttachment(const QString& filename);
 
+    int partCount(const QString& path = QString()) const;
+    QxtMailMimePart part(const QString& path) const;
+
+    QxtMailMimePart rootPart() const;
+    void setRootPart(const QxtMailMimePart& part);
+
     void setWordWrapLimit(int limit);
     void setWordWrapPreserveStartSpaces(bool state);
 
     QByteArray rfc2822() const;
-    static QxtMailMessage fromRfc2822(const QByteArray&);
+    static QxtMailMessage fromRfc2822(const QByteArray&, ParseMode mode = FullParse);
+    static QList<QxtMailMessage> fromRfc2822(const QList<QByteArray>& buffers, ParseMode mode = FullParse, QThreadPool* pool = 0);
+    static QHash<QString, QString> scanHeaders(const QByteArray& rfc2822, const QStringList& fields = QStringList());
 
 private:
+    friend class QxtSmtpPrivate;
+    friend class QxtMailMessageBuilder;
+    friend class QxtMailMaildir;
+    friend struct QxtMailMessagePrivate;
+    void render(QxtMailRenderArena& arena) const;
+
     QSharedDataPointer<QxtMailMessagePrivate> qxt_d;
 };
 Q_DECLARE_TYPEINFO(QxtMailMessage, Q_MOVABLE_TYPE);
@@ -0,0 +1,101 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILMESSAGE_P_H
+#define MAILMESSAGE_P_H
+
+#include "mailmessage.h"
+#include "mailutility_p.h"
+#include "mailrfc2822parser_p.h"
+#include <QMutex>
+
+struct QxtMailMessagePrivate : public QSharedData
+{
+    enum PendingPart
+    {
+        HeadersPending = 0x1,
+        BodyPending = 0x2,
+        PartsPending = 0x4,
+        AllPending = HeadersPending | BodyPending | PartsPending
+    };
+
+    QxtMailMessagePrivate() : pending(0), wordWrapLimit(78), preserveStartSpaces(false) {}
+    QxtMailMessagePrivate(const QxtMailMessagePrivate& other)
+            : QSharedData(other), rcptTo(other.rcptTo), rcptCc(other.rcptCc), rcptBcc(other.rcptBcc),
+            subject(other.subject), sender(other.sender), rootPart(other.rootPart),
+            wordWrapLimit(other.wordWrapLimit), preserveStartSpaces(other.preserveStartSpaces)
+    {
+        // other may be loading its lazily parsed parts in another thread
+        QMutexLocker locker(&other.parseMutex);
+        body = other.body;
+        extraHeaders = other.extraHeaders;
+        attachments = other.attachments;
+        pending = other.pending;
+        parser = other.parser;
+        entity = other.entity;
+    }
+    QStringList rcptTo, rcptCc, rcptBcc;
+    QString subject, body, sender;
+    QxtMailHeaders extraHeaders;
+    QHash<QString, QxtMailAttachment> attachments;
+    QxtMailMimePart rootPart;
+    // parts of a message built with QxtMailMessage::LazyParse that are still only
+    // indexed in the source held by the parser. The parts are decoded by load(),
+    // which must be called with parseMutex locked. The source and the index of
+    // its parts are kept for QxtMailMessage::part() until the parsed content
+    // is modified.
+    mutable int pending;
+    mutable QxtRfc2822Parser parser;
+    mutable QxtRfc2822Entity entity;
+    mutable QMutex parseMutex;
+    mutable QByteArray boundary;
+    // output of the last rfc2822() call; null when the message changed since.
+    // The mutex guards it, and the boundary, for copies used from several threads.
+    mutable QByteArray rendered;
+    mutable QMutex renderMutex;
+    int wordWrapLimit;
+    bool preserveStartSpaces;
+
+    void loadHeader(const QString& key) const;
+    void load(int parts) const;
+    void unlinkSource();
+    QByteArray source() const;
+    const QxtRfc2822Entity* findPart(const QString& path) const;
+    void render(QxtMailRenderArena& arena) const;
+    void renderTree(QxtMailRenderArena& arena) const;
+
+    // for code built with the sources of the library, such as the benchmarks
+    static const QxtMailMessagePrivate* get(const QxtMailMessage& message) { return message.qxt_d.constData(); }
+    // renders message into arena the way QxtSmtp does, through its render cache
+    static void renderMessage(const QxtMailMessage& message, QxtMailRenderArena& arena) { message.render(arena); }
+};
+
+#endif // MAILMESSAGE_P_H
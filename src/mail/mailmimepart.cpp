@@ -0,0 +1,341 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+/*!
+ * \class QxtMailMimePart
+ * \inmodule QxtNetwork
+ * \brief The QxtMailMimePart class represents a node of a MIME entity tree
+ *
+ * A part is either a leaf holding text or a QxtMailAttachment, or a multipart
+ * container (mixed, alternative, related...) holding other parts. Set the root
+ * of a tree with QxtMailMessage::setRootPart().
+ *
+ * Leaf parts are encoded on the first serialization and keep their encoded form
+ * until they are modified. As parts are implicitly shared, replacing one part of
+ * a tree only encodes that part again the next time the message is rendered.
+ */
+
+#include "mailmimepart.h"
+#include "mailutility_p.h"
+#include <QUuid>
+#include <QMutex>
+
+class QxtMailMimePartPrivate : public QSharedData
+{
+public:
+    QxtMailMimePart::Type type;
+    QString contentType;
+    QString text;
+    QxtMailAttachment attachment;
+    QString filename;
+    QList<QxtMailMimePart> parts;
+    QxtMailHeaders extraHeaders;
+    // encoded form of a leaf part, built by the first serialization
+    mutable QByteArray encoded;
+    mutable QByteArray boundary;
+    mutable QMutex mutex;
+
+    QxtMailMimePartPrivate() : type(QxtMailMimePart::Null), contentType(QStringLiteral("text/plain")) {}
+    QxtMailMimePartPrivate(const QxtMailMimePartPrivate& other)
+        : QSharedData(other), type(other.type), contentType(other.contentType), text(other.text),
+          attachment(other.attachment), filename(other.filename), parts(other.parts),
+          extraHeaders(other.extraHeaders)
+    {
+        // the copy is about to be modified, so don't take over the encoded form
+    }
+
+    void appendExtraHeaders(QByteArray& buffer) const;
+    QByteArray encode() const;
+};
+
+void QxtMailMimePartPrivate::appendExtraHeaders(QByteArray& buffer) const
+{
+    for (int i = 0; i < extraHeaders.count(); i++)
+    {
+        if (extraHeaders.id(i) == QxtMailHeaders::ContentType || extraHeaders.id(i) == QxtMailHeaders::ContentTransferEncoding)
+            continue; // written by the part itself
+        qxt_fold_mime_header(buffer, extraHeaders.name(i), extraHeaders.value(i));
+    }
+}
+
+QByteArray QxtMailMimePartPrivate::encode() const
+{
+    QByteArray rv;
+    if (type == QxtMailMimePart::Attachment)
+    {
+        if (!filename.isEmpty())
+            qxt_fold_mime_header(rv, QStringLiteral("Content-Disposition"), filename, QByteArrayLiteral("attachment; filename="));
+        appendExtraHeaders(rv);
+        attachment.appendMimeData(rv);
+        return rv;
+    }
+
+    QByteArray data;
+    qxt_append_utf8(data, text);
+    const QxtMailTransferEncoding encoding = qxt_choose_transfer_encoding(qxt_analyze_content(data.constData(), data.length()), true);
+    rv += "Content-Type: ";
+    qxt_append_latin1(rv, contentType);
+    rv += "; charset=UTF-8\r\nContent-Transfer-Encoding: ";
+    rv += qxt_transfer_encoding_name(encoding);
+    rv += "\r\n";
+    appendExtraHeaders(rv);
+    rv += "\r\n";
+    if (encoding == QxtMail7Bit)
+        qxt_encode_7bit(rv, data.constData(), data.length());
+    else if (encoding == QxtMailQuotedPrintable)
+        qxt_encode_quoted_printable(rv, data.constData(), data.length());
+    else
+        qxt_encode_base64(rv, data.constData(), data.length());
+    return rv;
+}
+
+/*!
+  Constructs a null part.
+  */
+QxtMailMimePart::QxtMailMimePart()
+{
+    qxt_d = new QxtMailMimePartPrivate;
+}
+
+QxtMailMimePart::QxtMailMimePart(const QxtMailMimePart& other) : qxt_d(other.qxt_d)
+{
+    // trivial copy constructor
+}
+
+QxtMailMimePart& QxtMailMimePart::operator=(const QxtMailMimePart& other)
+{
+    qxt_d = other.qxt_d;
+    return *this;
+}
+
+QxtMailMimePart::~QxtMailMimePart()
+{
+    // trivial destructor
+}
+
+/*!
+  Returns a leaf part holding \a text, sent as text/\a subtype in UTF-8.
+  */
+QxtMailMimePart QxtMailMimePart::fromText(const QString& text, const QString& subtype)
+{
+    QxtMailMimePart rv;
+    rv.qxt_d->type = Text;
+    rv.qxt_d->contentType = QStringLiteral("text/") + subtype;
+    rv.qxt_d->text = text;
+    return rv;
+}
+
+/*!
+  Returns a leaf part holding \a attachment. If \a filename isn't empty, the part
+  is marked as an attachment with that file name, otherwise set its
+  Content-Disposition and Content-ID with setExtraHeader().
+  */
+QxtMailMimePart QxtMailMimePart::fromAttachment(const QxtMailAttachment& attachment, const QString& filename)
+{
+    QxtMailMimePart rv;
+    rv.setAttachment(attachment, filename);
+    return rv;
+}
+
+/*!
+  Returns an empty multipart/\a subtype container, such as "mixed", "alternative"
+  or "related".
+  */
+QxtMailMimePart QxtMailMimePart::multipart(const QString& subtype)
+{
+    QxtMailMimePart rv;
+    rv.qxt_d->type = Multipart;
+    rv.qxt_d->contentType = QStringLiteral("multipart/") + subtype;
+    return rv;
+}
+
+QxtMailMimePart::Type QxtMailMimePart::type() const
+{
+    return qxt_d->type;
+}
+
+QString QxtMailMimePart::contentType() const
+{
+    if (qxt_d->type == Attachment)
+        return qxt_d->attachment.contentType();
+    return qxt_d->contentType;
+}
+
+QString QxtMailMimePart::text() const
+{
+    return qxt_d->text;
+}
+
+void QxtMailMimePart::setText(const QString& text)
+{
+    if (qxt_d->type != Text)
+    {
+        qxt_d->type = Text;
+        qxt_d->contentType = QStringLiteral("text/plain");
+    }
+    qxt_d->text = text;
+    qxt_d->encoded.clear();
+}
+
+QxtMailAttachment QxtMailMimePart::attachment() const
+{
+    return qxt_d->attachment;
+}
+
+QString QxtMailMimePart::filename() const
+{
+    return qxt_d->filename;
+}
+
+void QxtMailMimePart::setAttachment(const QxtMailAttachment& attachment, const QString& filename)
+{
+    qxt_d->type = Attachment;
+    qxt_d->attachment = attachment;
+    qxt_d->filename = filename;
+    qxt_d->encoded.clear();
+}
+
+int QxtMailMimePart::partCount() const
+{
+    return qxt_d->parts.count();
+}
+
+QxtMailMimePart QxtMailMimePart::part(int index) const
+{
+    return qxt_d->parts.value(index);
+}
+
+QList<QxtMailMimePart> QxtMailMimePart::parts() const
+{
+    return qxt_d->parts;
+}
+
+void QxtMailMimePart::addPart(const QxtMailMimePart& part)
+{
+    if (qxt_d->type != Multipart)
+    {
+        qWarning("QxtMailMimePart::addPart: not a multipart");
+        return;
+    }
+    qxt_d->parts.append(part);
+}
+
+/*!
+  Replaces the part at \a index with \a part. Only the new part is encoded again
+  when the tree is serialized.
+  */
+void QxtMailMimePart::replacePart(int index, const QxtMailMimePart& part)
+{
+    if (index < 0 || index >= qxt_d->parts.count())
+        return;
+    qxt_d->parts[index] = part;
+}
+
+void QxtMailMimePart::removePart(int index)
+{
+    if (index < 0 || index >= qxt_d->parts.count())
+        return;
+    qxt_d->parts.removeAt(index);
+}
+
+QHash<QString, QString> QxtMailMimePart::extraHeaders() const
+{
+    return qxt_d->extraHeaders.toHash();
+}
+
+QString QxtMailMimePart::extraHeader(const QString& key) const
+{
+    return qxt_d->extraHeaders.value(key);
+}
+
+bool QxtMailMimePart::hasExtraHeader(const QString& key) const
+{
+    return qxt_d->extraHeaders.contains(key);
+}
+
+void QxtMailMimePart::setExtraHeader(const QString& key, const QString& value)
+{
+    qxt_d->extraHeaders.set(key, value);
+    qxt_d->encoded.clear();
+}
+
+void QxtMailMimePart::removeExtraHeader(const QString& key)
+{
+    qxt_d->extraHeaders.remove(key);
+    qxt_d->encoded.clear();
+}
+
+/*!
+  Returns the part serialized as a MIME entity: its header fields, an empty line
+  and its encoded content.
+  */
+QByteArray QxtMailMimePart::mimeData() const
+{
+    QByteArray rv;
+    appendMimeData(rv);
+    return rv;
+}
+
+void QxtMailMimePart::appendMimeData(QByteArray& buffer) const
+{
+    const QxtMailMimePartPrivate* d = qxt_d.constData();
+    if (d->type != Multipart)
+    {
+        QMutexLocker locker(&d->mutex);
+        if (d->encoded.isNull())
+            d->encoded = d->encode();
+        buffer += d->encoded;
+        return;
+    }
+
+    // containers only write their header and delimiters around the parts
+    QMutexLocker locker(&d->mutex);
+    if (d->boundary.isEmpty())
+        d->boundary = QUuid::createUuid().toString().toLatin1().replace("{", "").replace("}", "");
+    locker.unlock();
+    buffer += "Content-Type: ";
+    qxt_append_latin1(buffer, d->contentType);
+    buffer += "; boundary=\"";
+    buffer += d->boundary;
+    buffer += "\"\r\n";
+    d->appendExtraHeaders(buffer);
+    buffer += "\r\n";
+    for (int i = 0; i < d->parts.count(); i++)
+    {
+        buffer += "--";
+        buffer += d->boundary;
+        buffer += "\r\n";
+        d->parts.at(i).appendMimeData(buffer);
+    }
+    buffer += "--";
+    buffer += d->boundary;
+    buffer += "--\r\n";
+}
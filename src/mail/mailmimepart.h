@@ -0,0 +1,96 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILMIMEPART_H
+#define MAILMIMEPART_H
+
+#include "mailglobal.h"
+#include "mailattachment.h"
+
+#include <QList>
+#include <QHash>
+#include <QSharedDataPointer>
+
+class QxtMailMimePartPrivate;
+class Q_MAIL_EXPORT QxtMailMimePart
+{
+public:
+    enum Type
+    {
+        Null,
+        Text,
+        Attachment,
+        Multipart
+    };
+
+    QxtMailMimePart();
+    QxtMailMimePart(const QxtMailMimePart& other);
+    QxtMailMimePart& operator=(const QxtMailMimePart& other);
+    ~QxtMailMimePart();
+
+    static QxtMailMimePart fromText(const QString& text, const QString& subtype = QStringLiteral("plain"));
+    static QxtMailMimePart fromAttachment(const QxtMailAttachment& attachment, const QString& filename = QString());
+    static QxtMailMimePart multipart(const QString& subtype = QStringLiteral("mixed"));
+
+    Type type() const;
+    QString contentType() const;
+
+    QString text() const;
+    void setText(const QString& text);
+
+    QxtMailAttachment attachment() const;
+    QString filename() const;
+    void setAttachment(const QxtMailAttachment& attachment, const QString& filename = QString());
+
+    int partCount() const;
+    QxtMailMimePart part(int index) const;
+    QList<QxtMailMimePart> parts() const;
+    void addPart(const QxtMailMimePart& part);
+    void replacePart(int index, const QxtMailMimePart& part);
+    void removePart(int index);
+
+    QHash<QString, QString> extraHeaders() const;
+    QString extraHeader(const QString&) const;
+    bool hasExtraHeader(const QString&) const;
+    void setExtraHeader(const QString& key, const QString& value);
+    void removeExtraHeader(const QString& key);
+
+    QByteArray mimeData() const;
+
+private:
+    friend struct QxtMailMessagePrivate;
+    void appendMimeData(QByteArray& buffer) const;
+
+    QSharedDataPointer<QxtMailMimePartPrivate> qxt_d;
+};
+Q_DECLARE_TYPEINFO(QxtMailMimePart, Q_MOVABLE_TYPE);
+
+#endif // MAILMIMEPART_H
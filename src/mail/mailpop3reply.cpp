@@ -36,6 +36,7 @@
 #include "mailpop3listreply.h"
 #include "mailpop3retrreply.h"
 #include "mailpop3_p.h"
+#include "mailrfc2822parser_p.h"
 #include <QTextStream>
 #ifndef QT_NO_OPENSSL
 #    include <QSslSocket>
@@ -296,17 +297,26 @@ public:
     };
 
     QxtMailMessage* message() {return m_msg;}
+    const QByteArray& rawMessage() const {return m_raw;}
     void setWhich(int which) {m_which = which;}
+    void setKeepRawMessage(bool keep) {m_keepRaw = keep;}
+    bool keepRawMessage() const {return m_keepRaw;}
 
 private:
     State state;
-    QByteArray m_message;
+    // parses the message as its lines arrive
+    QxtMailMessageBuilder m_builder;
+    // the message as it was sent, without the dots stuffed by the server;
+    // only kept on request
+    QByteArray m_raw;
+    bool m_keepRaw;
     QxtMailMessage* m_msg;
     int m_which;
     int m_length;
+    int m_received;
 };
 
-QxtPop3RetrReplyImpl::QxtPop3RetrReplyImpl(QxtPop3ReplyPrivate *reply): QxtPop3ReplyImpl(reply), state(StartState), m_msg(0), m_which(-1), m_length(0)
+QxtPop3RetrReplyImpl::QxtPop3RetrReplyImpl(QxtPop3ReplyPrivate *reply): QxtPop3ReplyImpl(reply), state(StartState), m_keepRaw(false), m_msg(0), m_which(-1), m_length(0), m_received(0)
 {
 }
 
@@ -323,6 +333,8 @@ QByteArray QxtPop3RetrReplyImpl::dialog(QByteArray received)
         if (isAnswerOK(received))
         {
             m_length = received.split(' ').at(2).toInt();
+            if (m_keepRaw)
+                m_raw.reserve(m_length);
             ret = buildCmd("RETR", QByteArray().number(m_which));
             state = RetrSent;
         } else {
@@ -348,17 +360,26 @@ QByteArray QxtPop3RetrReplyImpl::dialog(QByteArray received)
                 if (received.length() == 1)
                 {
                     // Termination line. The whole message is received by now.
-                    m_msg = new QxtMailMessage(m_message);
+                    m_builder.finish();
+                    m_msg = new QxtMailMessage(m_builder.message(m_raw));
                     m_reply->status = QxtPop3Reply::Completed;
                     m_reply->finish(QxtPop3Reply::OK);
+                    break;
                 }
                 else // remove first dot
                 {
                     received = received.mid(1);
                 }
             }
-            m_message += received + "\r\n";
-            int p = (100*m_message.length())/m_length;
+            m_builder.feed(received);
+            m_builder.feed("\r\n", 2);
+            if (m_keepRaw)
+            {
+                m_raw += received;
+                m_raw += "\r\n";
+            }
+            m_received += received.length() + 2;
+            int p = int((100 * qint64(m_received)) / m_length);
             m_reply->progress(p);
         }
         break;
@@ -749,6 +770,42 @@ QxtMailMessage* QxtPop3RetrReply::message()
     return dynamic_cast<QxtPop3RetrReplyImpl*>(impl())->message();
 }
 
+/*!
+  Returns the message retrieved from the server as it was received, once the
+  command has completed, if setKeepRawMessage() was enabled; otherwise returns a
+  null array. This is what should be stored, as message() gives the decoded
+  fields, which would be encoded again if the message was rendered.
+  */
+QByteArray QxtPop3RetrReply::rawMessage()
+{
+    return dynamic_cast<QxtPop3RetrReplyImpl*>(impl())->rawMessage();
+}
+
+/*!
+  Sets whether the message is kept as it is received, in addition to being
+  parsed, to \a keep. This is disabled by default, so that a large message is
+  not held twice. It must be set before the message starts to arrive, right
+  after QxtPop3::retrieveMessage().
+
+  When enabled, rawMessage() returns the received bytes, and the message()
+  built from them keeps them as its source: it can be stored as received with
+  QxtMailMaildir, and its parts can be decoded with QxtMailMessage::part().
+  */
+void QxtPop3RetrReply::setKeepRawMessage(bool keep)
+{
+    dynamic_cast<QxtPop3RetrReplyImpl*>(impl())->setKeepRawMessage(keep);
+}
+
+/*!
+  Returns whether the message is kept as it is received.
+
+  \sa setKeepRawMessage()
+  */
+bool QxtPop3RetrReply::keepRawMessage() const
+{
+    return dynamic_cast<const QxtPop3RetrReplyImpl*>(impl())->keepRawMessage();
+}
+
 QxtPop3ResetReply::QxtPop3ResetReply(int timeout, QObject* parent): QxtPop3Reply(timeout, parent)
 {
     setup(Reset);
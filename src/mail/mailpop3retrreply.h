@@ -39,6 +39,9 @@ class Q_MAIL_EXPORT QxtPop3RetrReply: public QxtPop3Reply
     friend class QxtPop3;
 public:
     QxtMailMessage* message();
+    QByteArray rawMessage();
+    void setKeepRawMessage(bool keep);
+    bool keepRawMessage() const;
 
 private:
     QxtPop3RetrReply(int which, int timeout, QObject* parent = 0);
@@ -0,0 +1,911 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#include "mailrfc2822parser_p.h"
+#include "mailmessage_p.h"
+#include <QTextCodec>
+#include <QRegExp>
+#include <QByteArrayMatcher>
+#include <QCache>
+#include <QThreadStorage>
+#include <QtDebug>
+#include <string.h>
+
+static int qxt_hex_value(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+}
+
+// parts nested deeper are left in the content of their parent
+static const int QXT_MIME_MAX_DEPTH = 32;
+
+QxtMailMessagePrivate* QxtRfc2822Parser::parse(const QByteArray& buffer)
+{
+    source = buffer;
+    QxtMailMessagePrivate* rv = new QxtMailMessagePrivate();
+    parseTree(QxtMailSpan(0, source.size()), rv->entity);
+    rv->extraHeaders = fieldHeaders(rv->entity);
+    parseBody(rv, rv->entity);
+    // the index of the parts stays available to QxtMailMessage::part()
+    rv->parser = *this;
+    return rv;
+}
+
+// Tokenizes the header section of the entity held in span in a single pass:
+// field names are checked while they are read, continuation lines extend the
+// value of the field before them, and the section ends at the first empty line.
+// Lines end with CRLF or with a bare LF. Without an empty line, the content is empty.
+void QxtRfc2822Parser::parseEntity(const QxtMailSpan& span, QxtRfc2822Entity& entity)
+{
+    const char* data = source.constData();
+    const int end = span.end;
+    entity.span = span;
+    entity.delimiter = span.begin;
+    entity.fields.clear();
+    entity.parts.clear();
+    entity.body = QxtMailSpan(end, end);
+    QxtRfc2822Field field;
+    bool current = false; // true while field can take continuation lines
+    int pos = span.begin;
+    while (pos < end)
+    {
+        const char ch = data[pos];
+        if (ch == '\n' || (ch == '\r' && (pos + 1 == end || data[pos + 1] == '\n')))
+        {
+            // empty line reached: end of headers section
+            entity.body = QxtMailSpan(qMin(pos + (ch == '\r' ? 2 : 1), end), end);
+            break;
+        }
+        int i = pos;
+        if (ch != ' ' && ch != '\t')
+        {
+            // starting a new header field. Store the current one before
+            if (current)
+                entity.fields.append(field);
+            // field-name = 1*(%d33-57 / %d59-126), followed by a colon
+            while (i < end && data[i] >= '!' && data[i] <= '~' && data[i] != ':')
+                i++;
+            current = i > pos && i < end && data[i] == ':';
+            if (current)
+            {
+                field.name = QxtMailSpan(pos, i);
+                i++;
+                while (i < end && (data[i] == ' ' || data[i] == '\t'))
+                    i++;
+                field.value.begin = i;
+            } // else: malformed header line. Ignore.
+        }
+        const char* lf = static_cast<const char*>(memchr(data + i, '\n', end - i));
+        int lineEnd = lf ? int(lf - data) : end;
+        pos = lf ? lineEnd + 1 : end;
+        if (lineEnd > i && data[lineEnd - 1] == '\r')
+            lineEnd--;
+        if (current)
+            field.value.end = qMax(field.value.begin, lineEnd);
+    }
+    if (current)
+        entity.fields.append(field);
+}
+
+// Parses the entity held in span, and the parts of its content recursively if
+// it is a multipart.
+void QxtRfc2822Parser::parseTree(const QxtMailSpan& span, QxtRfc2822Entity& entity, int depth)
+{
+    parseEntity(span, entity);
+    if (depth >= QXT_MIME_MAX_DEPTH)
+        return;
+    const QByteArray boundary = QxtRfc2822Parser::boundary(contentType(entity));
+    if (boundary.isEmpty())
+        return;
+    const QVector<QxtMailSpan> delimiters = findDelimiters(entity.body, boundary);
+    for (int i = 0; i + 1 < delimiters.count(); i++)
+    {
+        entity.parts.append(QxtRfc2822Entity());
+        QxtRfc2822Entity& part = entity.parts.last();
+        parseTree(QxtMailSpan(delimiters.at(i).end, delimiters.at(i + 1).begin), part, depth + 1);
+        part.delimiter = delimiters.at(i).begin;
+    }
+}
+
+// returns the value of the Content-Type field of entity, or an empty string
+QString QxtRfc2822Parser::contentType(const QxtRfc2822Entity& entity) const
+{
+    for (int i = entity.fields.count() - 1; i >= 0; i--)
+    {
+        if (fieldNameIs(entity.fields.at(i), QStringLiteral("content-type")))
+            return fieldValue(entity.fields.at(i));
+    }
+    return QString();
+}
+
+QByteArray QxtRfc2822Parser::bytes(const QxtMailSpan& span) const
+{
+    return source.mid(span.begin, span.length());
+}
+
+QString QxtRfc2822Parser::fieldName(const QxtRfc2822Field& field) const
+{
+    return QString::fromLatin1(source.constData() + field.name.begin, field.name.length());
+}
+
+// compares the name of field with the lowercase name, ignoring case
+bool QxtRfc2822Parser::fieldNameIs(const QxtRfc2822Field& field, const QString& name) const
+{
+    if (field.name.length() != name.length())
+        return false;
+    const char* data = source.constData() + field.name.begin;
+    const QChar* n = name.constData();
+    for (int i = 0; i < name.length(); i++)
+    {
+        char ch = data[i];
+        if (ch >= 'A' && ch <= 'Z')
+            ch += 'a' - 'A';
+        if (n[i].unicode() != ushort(uchar(ch)))
+            return false;
+    }
+    return true;
+}
+
+// returns the value of field unfolded in one pass over its bytes, with its
+// encoded words decoded
+QString QxtRfc2822Parser::fieldValue(const QxtRfc2822Field& field) const
+{
+    const char* data = source.constData();
+    QString value(field.value.length(), Qt::Uninitialized);
+    QChar* out = value.data();
+    int length = 0;
+    bool encoded = false;
+    for (int i = field.value.begin; i < field.value.end; i++)
+    {
+        const char ch = data[i];
+        // drop the line breaks, keep the white space starting the continuation lines
+        if (ch == '\r' || ch == '\n')
+            continue;
+        if (ch == '?' && i > field.value.begin && data[i - 1] == '=')
+            encoded = true;
+        out[length++] = QChar(uchar(ch));
+    }
+    value.truncate(length);
+    return encoded ? decodeWords(value.toLatin1()) : value;
+}
+
+// returns the header fields of entity in their order; a repeated field keeps its last value
+QxtMailHeaders QxtRfc2822Parser::fieldHeaders(const QxtRfc2822Entity& entity) const
+{
+    QxtMailHeaders headers;
+    foreach (const QxtRfc2822Field& field, entity.fields)
+        headers.set(fieldName(field), fieldValue(field));
+    return headers;
+}
+
+// Returns the delimiter lines of boundary found at line starts in span, from
+// their first dash to the first byte after their line break, up to and
+// including the close delimiter. The body is scanned once.
+QVector<QxtMailSpan> QxtRfc2822Parser::findDelimiters(const QxtMailSpan& span, const QByteArray& boundary) const
+{
+    QVector<QxtMailSpan> delimiters;
+    const QByteArray dashBoundary = "--" + boundary;
+    const QByteArrayMatcher matcher(dashBoundary);
+    const char* data = source.constData();
+    const int end = span.end;
+    int pos = span.begin;
+    while ((pos = matcher.indexIn(data, end, pos)) != -1)
+    {
+        int i = pos + dashBoundary.size();
+        if (pos != span.begin && data[pos - 1] != '\n')
+        {
+            pos = i; // not at the start of a line
+            continue;
+        }
+        const bool close = i + 1 < end && data[i] == '-' && data[i + 1] == '-';
+        if (close)
+            i += 2;
+        while (i < end && (data[i] == ' ' || data[i] == '\t'))
+            i++;
+        if (i < end && data[i] == '\r')
+            i++;
+        if (i < end && data[i] != '\n')
+        {
+            pos = i; // the boundary only starts the line
+            continue;
+        }
+        if (i < end)
+            i++;
+        delimiters.append(QxtMailSpan(pos, i));
+        if (close)
+            break;
+        pos = i;
+    }
+    return delimiters;
+}
+
+// Extracts the attachments from the parts of a multipart body indexed by
+// parseTree(), and builds the body from the rest. Only the parts of the top
+// level are considered; nested parts are reached through decodePart().
+void QxtRfc2822Parser::parseBody(QxtMailMessagePrivate* msg, const QxtRfc2822Entity& entity)
+{
+    const char* data = source.constData();
+    QString& body = msg->body;
+    body.clear();
+    body.reserve(entity.body.length());
+    // start of the text not yet copied to the body
+    int kept = entity.body.begin;
+    foreach (const QxtRfc2822Entity& part, entity.parts)
+    {
+        const QxtMailHeaders partHeaders = fieldHeaders(part);
+        if (partHeaders.value(QxtMailHeaders::ContentDisposition).indexOf(QStringLiteral("attachment;")) != 0)
+            continue;
+        QString filename;
+        QxtMailAttachment* attachment = parseAttachment(partHeaders, part.body, filename);
+        if (attachment)
+        {
+            if (filename.isEmpty())
+                filename = defaultFilename();
+            msg->attachments.insert(filename, *attachment);
+            delete attachment;
+        }
+        // strip the part and its delimiter from body
+        body.append(QLatin1String(data + kept, part.delimiter - kept));
+        kept = part.span.end;
+    }
+    body.append(QLatin1String(data + kept, entity.body.end - kept));
+}
+
+// Decodes entity into a MIME part: a multipart entity gives a container with its
+// parts decoded, and any other entity an attachment holding its decoded content.
+QxtMailMimePart QxtRfc2822Parser::decodePart(const QxtRfc2822Entity& entity) const
+{
+    const QxtMailHeaders headers = fieldHeaders(entity);
+    const QString contentType = headers.value(QxtMailHeaders::ContentType);
+    if (!entity.parts.isEmpty() || !QxtRfc2822Parser::boundary(contentType).isEmpty())
+    {
+        const QString subtype = contentType.section(QLatin1Char(';'), 0, 0).section(QLatin1Char('/'), 1).trimmed();
+        QxtMailMimePart rv = QxtMailMimePart::multipart(subtype.isEmpty() ? QStringLiteral("mixed") : subtype);
+        foreach (const QxtRfc2822Entity& part, entity.parts)
+            rv.addPart(decodePart(part));
+        return rv;
+    }
+    QString filename;
+    QxtMailAttachment* attachment = parseAttachment(headers, entity.body, filename);
+    // only an attachment disposition with a filename is kept as the part's
+    // filename, which writes the field again; other dispositions stay as they are
+    if (!filename.isEmpty() && headers.value(QxtMailHeaders::ContentDisposition).startsWith(QLatin1String("attachment"), Qt::CaseInsensitive))
+        attachment->removeExtraHeader(QStringLiteral("Content-Disposition"));
+    else
+        filename.clear();
+    QxtMailMimePart rv = QxtMailMimePart::fromAttachment(*attachment, filename);
+    delete attachment;
+    return rv;
+}
+
+// character set of encoded words, resolved once per name
+struct QxtMailCharset
+{
+    enum Kind
+    {
+        Latin1,
+        Utf8,
+        Codec
+    };
+
+    Kind kind;
+    QTextCodec* codec;
+    // whether bytes below 0x80 always stand for ASCII characters
+    bool asciiCompatible;
+};
+
+// Each thread keeps the few character sets it met last. The names come from
+// the messages, so only the ones Qt knows are kept, and not too many of them.
+class QxtMailCharsetCache
+{
+public:
+    QxtMailCharsetCache() : charsets(64) {}
+
+    QxtMailCharset lookup(const char* name, int length);
+
+private:
+    QCache<QByteArray, QxtMailCharset> charsets;
+};
+
+static QxtMailCharsetCache* qxt_charset_cache()
+{
+    static QThreadStorage<QxtMailCharsetCache*> caches;
+    if (!caches.hasLocalData())
+        caches.setLocalData(new QxtMailCharsetCache);
+    return caches.localData();
+}
+
+static bool qxt_charset_is(const char* name, int length, const char* known)
+{
+    return int(qstrlen(known)) == length && qstrnicmp(name, known, length) == 0;
+}
+
+QxtMailCharset QxtMailCharsetCache::lookup(const char* name, int length)
+{
+    QxtMailCharset rv;
+    rv.kind = QxtMailCharset::Latin1;
+    rv.codec = 0;
+    rv.asciiCompatible = true;
+    // the common character sets don't need a codec
+    if (qxt_charset_is(name, length, "utf-8") || qxt_charset_is(name, length, "utf8"))
+    {
+        rv.kind = QxtMailCharset::Utf8;
+        return rv;
+    }
+    if (qxt_charset_is(name, length, "us-ascii") || qxt_charset_is(name, length, "iso-8859-1")
+        || qxt_charset_is(name, length, "latin1"))
+        return rv;
+
+    const QByteArray key = QByteArray(name, length).toLower();
+    if (const QxtMailCharset* cached = charsets.object(key))
+        return *cached;
+    rv.codec = QTextCodec::codecForName(key);
+    // an unknown character set is read as Latin-1 rather than dropped
+    if (!rv.codec)
+        return rv;
+    rv.kind = QxtMailCharset::Codec;
+    rv.asciiCompatible = !key.startsWith("utf-16") && !key.startsWith("utf-32") && !key.startsWith("utf-7")
+                         && !key.startsWith("iso-2022") && key != "hz-gb-2312";
+    charsets.insert(key, new QxtMailCharset(rv));
+    return rv;
+}
+
+static int qxt_base64_value(char ch)
+{
+    if (ch >= 'A' && ch <= 'Z')
+        return ch - 'A';
+    if (ch >= 'a' && ch <= 'z')
+        return ch - 'a' + 26;
+    if (ch >= '0' && ch <= '9')
+        return ch - '0' + 52;
+    if (ch == '+')
+        return 62;
+    if (ch == '/')
+        return 63;
+    return -1;
+}
+
+static bool qxt_is_blank(const char* data, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (data[i] != ' ' && data[i] != '\t')
+            return false;
+    }
+    return true;
+}
+
+// converts the decoded bytes of a run of encoded words and appends them to out
+static void qxt_flush_words(QString& out, QByteArray& bytes, const QxtMailCharset& charset)
+{
+    if (bytes.isEmpty())
+        return;
+    bool ascii = charset.kind != QxtMailCharset::Codec || charset.asciiCompatible;
+    for (int i = 0; ascii && i < bytes.size(); i++)
+        ascii = uchar(bytes.at(i)) < 0x80;
+    if (ascii || charset.kind == QxtMailCharset::Latin1)
+        out.append(QLatin1String(bytes.constData(), bytes.size()));
+    else if (charset.kind == QxtMailCharset::Utf8)
+        out.append(QString::fromUtf8(bytes.constData(), bytes.size()));
+    else
+        out.append(charset.codec->toUnicode(bytes.constData(), bytes.size()));
+    bytes.resize(0);
+}
+
+// Decodes the RFC 2047 encoded words of value in one pass. The bytes of adjacent
+// words in the same character set are joined before they are converted, so that
+// a character split across two words decodes whole, and the white space between
+// adjacent words is dropped. Malformed words are kept as they are.
+QString QxtRfc2822Parser::decodeWords(const QByteArray& value)
+{
+    const char* data = value.constData();
+    const int length = value.size();
+    QString out;
+    out.reserve(length);
+    // decoded bytes of the current run of words
+    QByteArray bytes;
+    bytes.reserve(length);
+    QxtMailCharset charset;
+    charset.kind = QxtMailCharset::Latin1;
+    const char* charsetName = 0;
+    int charsetLength = 0;
+    // start of the text not yet copied to out, and end of the last word
+    int copied = 0;
+    int wordEnd = -1;
+    int i = 0;
+    while (i + 1 < length)
+    {
+        if (data[i] != '=' || data[i + 1] != '?')
+        {
+            i++;
+            continue;
+        }
+        // =?charset?encoding?text?=
+        const int nameBegin = i + 2;
+        int p = nameBegin;
+        while (p < length && data[p] != '?' && data[p] != ' ' && data[p] != '\t')
+            p++;
+        const char encoding = p + 2 < length ? (data[p + 1] | 0x20) : 0;
+        if (p == nameBegin || p + 2 >= length || data[p] != '?' || (encoding != 'q' && encoding != 'b') || data[p + 2] != '?')
+        {
+            i++;
+            continue;
+        }
+        int nameEnd = p;
+        // drop an RFC 2231 language suffix
+        for (int k = nameBegin; k < p; k++)
+        {
+            if (data[k] == '*')
+            {
+                nameEnd = k;
+                break;
+            }
+        }
+        const int textBegin = p + 3;
+        int textEnd = textBegin;
+        while (textEnd + 1 < length && !(data[textEnd] == '?' && data[textEnd + 1] == '=')
+               && data[textEnd] != ' ' && data[textEnd] != '\t')
+            textEnd++;
+        if (textEnd + 1 >= length || data[textEnd] != '?')
+        {
+            i++;
+            continue;
+        }
+
+        const char* name = data + nameBegin;
+        const int nameLength = nameEnd - nameBegin;
+        const bool sameCharset = charsetName && charsetLength == nameLength && qstrnicmp(charsetName, name, nameLength) == 0;
+        if (wordEnd != copied || !qxt_is_blank(data + copied, i - copied))
+        {
+            qxt_flush_words(out, bytes, charset);
+            out.append(QLatin1String(data + copied, i - copied));
+        }
+        else if (!sameCharset)
+        {
+            qxt_flush_words(out, bytes, charset);
+        }
+        if (!sameCharset)
+        {
+            charset = qxt_charset_cache()->lookup(name, nameLength);
+            charsetName = name;
+            charsetLength = nameLength;
+        }
+
+        if (encoding == 'q')
+        {
+            for (int k = textBegin; k < textEnd; k++)
+            {
+                const char ch = data[k];
+                if (ch == '_')
+                {
+                    bytes += ' ';
+                }
+                else if (ch == '=' && k + 2 < textEnd && qxt_hex_value(data[k + 1]) >= 0 && qxt_hex_value(data[k + 2]) >= 0)
+                {
+                    bytes += char(qxt_hex_value(data[k + 1]) << 4 | qxt_hex_value(data[k + 2]));
+                    k += 2;
+                }
+                else
+                {
+                    bytes += ch;
+                }
+            }
+        }
+        else
+        {
+            uint bits = 0;
+            int count = 0;
+            for (int k = textBegin; k < textEnd; k++)
+            {
+                const int v = qxt_base64_value(data[k]);
+                if (v < 0)
+                    continue; // padding
+                bits = (bits << 6) | uint(v);
+                count += 6;
+                if (count >= 8)
+                {
+                    count -= 8;
+                    bytes += char(bits >> count);
+                    bits &= (1u << count) - 1;
+                }
+            }
+        }
+        copied = wordEnd = i = textEnd + 2;
+    }
+    qxt_flush_words(out, bytes, charset);
+    out.append(QLatin1String(data + copied, length - copied));
+    return out;
+}
+
+QxtMailAttachment* QxtRfc2822Parser::parseAttachment(const QxtMailHeaders& headers, const QxtMailSpan& body, QString& filename) const
+{
+    QByteArray content;
+    QRegExp filenameRe(QStringLiteral(";\\s+filename=\"?([^\"]*)\"?(?=;|$)"));
+    if (filenameRe.indexIn(headers.value(QxtMailHeaders::ContentDisposition)) != -1)
+    {
+        filename = filenameRe.cap(1);
+    }
+
+    QString ct;
+    if (headers.contains(QxtMailHeaders::ContentType))
+    {
+        ct = headers.value(QxtMailHeaders::ContentType);
+    }
+    else
+    {
+        ct = QStringLiteral("application/octet-stream");
+    }
+
+    QString cte;
+    if (headers.contains(QxtMailHeaders::ContentTransferEncoding))
+    {
+        cte = headers.value(QxtMailHeaders::ContentTransferEncoding).toLower();
+    }
+    const char* src = source.constData() + body.begin;
+    const int len = body.length();
+    if ( cte == QLatin1String("base64"))
+    {
+        content = QByteArray::fromBase64(QByteArray::fromRawData(src, len));
+    }
+    else if (cte == QStringLiteral("quoted-printable"))
+    {
+        content.reserve(len);
+        for (int i = 0; i < len; i++)
+        {
+            if (src[i] == '\r' && i + 1 < len && src[i + 1] == '\n')
+            {
+                content += '\n';
+                i++;
+            }
+            else if (src[i] == '=')
+            {
+                if (i+2 < len)
+                {
+                    if (src[i + 1] == '\r' && src[i + 2] == '\n') // soft line break; skip
+                    {
+                        i +=2;
+                    }
+                    else
+                    {
+                        const int high = qxt_hex_value(src[i + 1]);
+                        const int low = qxt_hex_value(src[i + 2]);
+                        if (high < 0 || low < 0)
+                        {
+                            content += '='; // not an escape: keep it as it is
+                            continue;
+                        }
+                        content += char(high << 4 | low);
+                        i += 2;
+                    }
+                }
+            }
+            else
+            {
+                content += src[i];
+            }
+        }
+    }
+    else // assume 7bit or 8bit
+    {
+        content = QByteArray(src, len);
+        if (isTextMedia(ct))
+        {
+            content.replace("\r\n","\n");
+        }
+    }
+    QxtMailAttachment* rv = new QxtMailAttachment(content, ct);
+    for (int i = 0; i < headers.count(); i++)
+        rv->setExtraHeader(headers.name(i), headers.value(i));
+    return rv;
+}
+
+// returns the boundary parameter of a multipart Content-Type, or an empty array
+QByteArray QxtRfc2822Parser::boundary(const QString& contentType)
+{
+    if (contentType.indexOf(QStringLiteral("multipart"), 0, Qt::CaseInsensitive) != 0)
+        return QByteArray();
+    int pos = contentType.indexOf(QStringLiteral("boundary="), 0, Qt::CaseInsensitive);
+    if (pos == -1)
+        return QByteArray();
+    pos += 9;
+    int end;
+    if (pos < contentType.length() && contentType.at(pos) == QLatin1Char('"'))
+    {
+        pos++;
+        end = contentType.indexOf(QLatin1Char('"'), pos);
+    }
+    else
+    {
+        end = contentType.indexOf(QLatin1Char(';'), pos);
+    }
+    if (end == -1)
+        end = contentType.length();
+    return contentType.mid(pos, end - pos).trimmed().toLatin1();
+}
+
+QxtMailPushParser::QxtMailPushParser()
+{
+}
+
+QxtMailPushParser::~QxtMailPushParser()
+{
+}
+
+void QxtMailPushParser::feed(const char* data, int size)
+{
+    int pos = 0;
+    while (pos < size)
+    {
+        const char* lf = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        if (!lf)
+        {
+            // keep the incomplete line for the next chunk
+            pendingLine.append(data + pos, size - pos);
+            break;
+        }
+        const int next = int(lf - data) + 1;
+        if (pendingLine.isEmpty())
+        {
+            processLine(data + pos, next - pos);
+        }
+        else
+        {
+            pendingLine.append(data + pos, next - pos);
+            processLine(pendingLine.constData(), pendingLine.size());
+            pendingLine.clear();
+        }
+        pos = next;
+    }
+}
+
+// to be called after the last chunk: ends all the open entities
+void QxtMailPushParser::finish()
+{
+    if (!pendingLine.isEmpty())
+    {
+        processLine(pendingLine.constData(), pendingLine.size());
+        pendingLine.clear();
+    }
+    while (!levels.isEmpty())
+    {
+        if (levels.last().inHeader)
+            endHeader();
+        partEnd(levels.count() - 1);
+        levels.removeLast();
+    }
+}
+
+void QxtMailPushParser::processLine(const char* line, int size)
+{
+    if (levels.isEmpty())
+    {
+        levels.append(Level());
+        partStart(0, QByteArray());
+    }
+    Level& current = levels.last();
+    if (current.inHeader)
+    {
+        current.header.append(line, size);
+        if (line[0] == '\n' || (line[0] == '\r' && (size == 1 || line[1] == '\n')))
+            endHeader();
+        return;
+    }
+    if (size > 2 && line[0] == '-' && line[1] == '-')
+    {
+        // a delimiter of the innermost multipart entity, or of an enclosing one
+        // ending the entities nested in it
+        for (int depth = levels.count() - 1; depth >= 0; depth--)
+        {
+            const QByteArray& boundary = levels.at(depth).boundary;
+            if (boundary.isEmpty() || size < boundary.size() + 2 || memcmp(line + 2, boundary.constData(), boundary.size()) != 0)
+                continue;
+            int i = boundary.size() + 2;
+            const bool close = i + 1 < size && line[i] == '-' && line[i + 1] == '-';
+            if (close)
+                i += 2;
+            while (i < size && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r' || line[i] == '\n'))
+                i++;
+            if (i != size)
+                continue;
+            while (levels.count() > depth + 1)
+            {
+                if (levels.last().inHeader)
+                    endHeader();
+                partEnd(levels.count() - 1);
+                levels.removeLast();
+            }
+            if (close)
+            {
+                // no part follows: the rest is the epilogue
+                levels[depth].boundary.clear();
+                partData(depth, line, size);
+            }
+            else
+            {
+                levels.append(Level());
+                partStart(depth + 1, QByteArray(line, size));
+            }
+            return;
+        }
+    }
+    partData(levels.count() - 1, line, size);
+}
+
+void QxtMailPushParser::endHeader()
+{
+    const int depth = levels.count() - 1;
+    Level& current = levels[depth];
+    current.inHeader = false;
+    QxtRfc2822Parser parser;
+    parser.setBuffer(current.header);
+    QxtRfc2822Entity entity;
+    parser.parseEntity(QxtMailSpan(0, current.header.size()), entity);
+    foreach (const QxtRfc2822Field& field, entity.fields)
+    {
+        const QString value = parser.fieldValue(field);
+        if (parser.fieldNameIs(field, QStringLiteral("content-type")))
+            current.boundary = QxtRfc2822Parser::boundary(value);
+        headerField(depth, parser.fieldName(field), value);
+    }
+    const QByteArray header = current.header;
+    current.header.clear();
+    headersEnd(depth, header);
+}
+
+void QxtMailPushParser::partStart(int, const QByteArray&)
+{
+}
+
+void QxtMailPushParser::headerField(int, const QString&, const QString&)
+{
+}
+
+void QxtMailPushParser::headersEnd(int, const QByteArray&)
+{
+}
+
+void QxtMailPushParser::partData(int, const char*, int)
+{
+}
+
+void QxtMailPushParser::partEnd(int)
+{
+}
+
+QxtMailMessageBuilder::QxtMailMessageBuilder() : msg(new QxtMailMessagePrivate), sink(&body), attachment(false)
+{
+}
+
+QxtMailMessageBuilder::~QxtMailMessageBuilder()
+{
+    delete msg;
+}
+
+// Returns the message built so far; finish() should have been called before.
+// source, when given, holds all the data that was fed, and becomes the source
+// of the message like the buffer given to parse(). Its parts are then indexed
+// when they are first asked for, as with LazyParse.
+QxtMailMessage QxtMailMessageBuilder::message(const QByteArray& source)
+{
+    if (!source.isNull())
+    {
+        msg->parser.setBuffer(source);
+        msg->entity.span = QxtMailSpan(0, source.size());
+        msg->pending |= QxtMailMessagePrivate::PartsPending;
+    }
+    QxtMailMessage rv;
+    rv.qxt_d = msg;
+    msg = new QxtMailMessagePrivate;
+    parser = QxtRfc2822Parser();
+    return rv;
+}
+
+void QxtMailMessageBuilder::partStart(int depth, const QByteArray& delimiter)
+{
+    if (depth == 1)
+    {
+        // kept until the header tells whether the part is an attachment
+        this->delimiter = delimiter;
+        partHeaders.clear();
+        attachment = false;
+    }
+    else if (depth > 1)
+    {
+        sink->append(delimiter);
+    }
+}
+
+void QxtMailMessageBuilder::headerField(int depth, const QString& name, const QString& value)
+{
+    if (depth == 0)
+        msg->extraHeaders.set(name, value);
+    else if (depth == 1)
+        partHeaders.set(name, value);
+}
+
+void QxtMailMessageBuilder::headersEnd(int depth, const QByteArray& header)
+{
+    if (depth == 1)
+    {
+        attachment = partHeaders.value(QxtMailHeaders::ContentDisposition).indexOf(QStringLiteral("attachment;")) == 0;
+        if (attachment)
+        {
+            content.clear();
+            sink = &content;
+            return;
+        }
+        sink = &body;
+        sink->append(delimiter);
+    }
+    if (depth > 0)
+        sink->append(header);
+}
+
+void QxtMailMessageBuilder::partData(int depth, const char* data, int size)
+{
+    if (depth == 0)
+        body.append(data, size);
+    else
+        sink->append(data, size);
+}
+
+void QxtMailMessageBuilder::partEnd(int depth)
+{
+    if (depth == 1)
+    {
+        if (attachment)
+        {
+            parser.setBuffer(content);
+            QString filename;
+            QxtMailAttachment* part = parser.parseAttachment(partHeaders, QxtMailSpan(0, content.size()), filename);
+            if (part)
+            {
+                if (filename.isEmpty())
+                    filename = parser.defaultFilename();
+                msg->attachments.insert(filename, *part);
+                delete part;
+            }
+            content.clear();
+        }
+        sink = &body;
+    }
+    else if (depth == 0)
+    {
+        msg->body = QString::fromLatin1(body);
+        body.clear();
+    }
+}
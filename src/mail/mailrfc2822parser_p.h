@@ -0,0 +1,201 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef MAILRFC2822PARSER_P_H
+#define MAILRFC2822PARSER_P_H
+
+#include "mailglobal.h"
+#include "mailmimepart.h"
+#include <QByteArray>
+#include <QString>
+#include "mailutility_p.h"
+#include <QVector>
+
+struct QxtMailMessagePrivate;
+class QxtMailAttachment;
+class QxtMailMessage;
+
+// A range of bytes of the buffer being parsed, from begin up to end excluded.
+struct QxtMailSpan
+{
+    QxtMailSpan() : begin(0), end(0) {}
+    QxtMailSpan(int b, int e) : begin(b), end(e) {}
+    int length() const { return end - begin; }
+    bool isEmpty() const { return end <= begin; }
+
+    int begin;
+    int end;
+};
+Q_DECLARE_TYPEINFO(QxtMailSpan, Q_PRIMITIVE_TYPE);
+
+// A header field. The value span starts after the colon and the white space
+// following it, and ends before the line break of its last line, continuation
+// lines included.
+struct QxtRfc2822Field
+{
+    QxtMailSpan name;
+    QxtMailSpan value;
+};
+Q_DECLARE_TYPEINFO(QxtRfc2822Field, Q_PRIMITIVE_TYPE);
+
+// A MIME entity: the spans of the whole entity, of its header fields and of its
+// content, and the entities of its parts when it is a multipart indexed by
+// parseTree(). delimiter is the offset of the delimiter line introducing a part.
+struct QxtRfc2822Entity
+{
+    QxtRfc2822Entity() : delimiter(0) {}
+
+    QxtMailSpan span;
+    int delimiter;
+    QVector<QxtRfc2822Field> fields;
+    QxtMailSpan body;
+    QList<QxtRfc2822Entity> parts;
+};
+
+/*
+  The parser works on spans of the buffer it was given, which it shares without
+  copying; names, values and contents are only turned into strings or decoded
+  when they are asked for.
+  */
+class QxtRfc2822Parser
+{
+public:
+    QxtRfc2822Parser() : attachmentCount(0) {}
+
+    QxtMailMessagePrivate* parse(const QByteArray& buffer);
+
+    void setBuffer(const QByteArray& buffer) { source = buffer; }
+    const QByteArray& buffer() const { return source; }
+
+    void parseEntity(const QxtMailSpan& span, QxtRfc2822Entity& entity);
+    void parseTree(const QxtMailSpan& span, QxtRfc2822Entity& entity, int depth = 0);
+    QByteArray bytes(const QxtMailSpan& span) const;
+    QString fieldName(const QxtRfc2822Field& field) const;
+    bool fieldNameIs(const QxtRfc2822Field& field, const QString& name) const;
+    QString fieldValue(const QxtRfc2822Field& field) const;
+    QxtMailHeaders fieldHeaders(const QxtRfc2822Entity& entity) const;
+    QString contentType(const QxtRfc2822Entity& entity) const;
+    QVector<QxtMailSpan> findDelimiters(const QxtMailSpan& span, const QByteArray& boundary) const;
+    void parseBody(QxtMailMessagePrivate* msg, const QxtRfc2822Entity& entity);
+    QxtMailAttachment* parseAttachment(const QxtMailHeaders& headers, const QxtMailSpan& body, QString& filename) const;
+    QString defaultFilename() { return QStringLiteral("attachment%1").arg(++attachmentCount); }
+    QxtMailMimePart decodePart(const QxtRfc2822Entity& entity) const;
+
+    static QByteArray boundary(const QString& contentType);
+
+private:
+    QByteArray source;
+    // numbers the attachments given a default name
+    int attachmentCount;
+
+    static QString decodeWords(const QByteArray& value);
+};
+
+/*
+  Incremental MIME parser: data is pushed in chunks of any size with feed(), and
+  the structure of the message is reported through the virtual event methods as
+  soon as the lines making it are complete. Depth 0 is the message itself, and
+  the parts of a multipart entity at depth n are at depth n + 1.
+  */
+class QxtMailPushParser
+{
+public:
+    QxtMailPushParser();
+    virtual ~QxtMailPushParser();
+
+    void feed(const char* data, int size);
+    void feed(const QByteArray& data) { feed(data.constData(), data.size()); }
+    void finish();
+
+protected:
+    // a new entity starts; delimiter is the delimiter line introducing a part
+    virtual void partStart(int depth, const QByteArray& delimiter);
+    // a header field of the current entity, unfolded and decoded
+    virtual void headerField(int depth, const QString& name, const QString& value);
+    // end of the header section, given as received with its empty line
+    virtual void headersEnd(int depth, const QByteArray& header);
+    // a line of content, with its line break. For a multipart entity, these are
+    // the lines outside of its parts, including the close delimiter.
+    virtual void partData(int depth, const char* data, int size);
+    virtual void partEnd(int depth);
+
+private:
+    struct Level
+    {
+        Level() : inHeader(true) {}
+        bool inHeader;
+        QByteArray header;
+        QByteArray boundary;
+    };
+
+    void processLine(const char* line, int size);
+    void endHeader();
+
+    QVector<Level> levels;
+    QByteArray pendingLine;
+};
+
+/*
+  Push parser building a message as it is fed, with the same fields, body and
+  attachments as QxtRfc2822Parser::parse(): only the content of the attachment
+  being received is kept aside until the end of its part, where it is decoded.
+  The data fed is not kept, so the parts of the message are only indexed for
+  QxtMailMessage::part() and partCount() when the caller keeps that data and
+  gives it to message(); otherwise they report no parts.
+  */
+class QxtMailMessageBuilder : public QxtMailPushParser
+{
+public:
+    QxtMailMessageBuilder();
+    ~QxtMailMessageBuilder();
+
+    QxtMailMessage message(const QByteArray& source = QByteArray());
+
+protected:
+    void partStart(int depth, const QByteArray& delimiter);
+    void headerField(int depth, const QString& name, const QString& value);
+    void headersEnd(int depth, const QByteArray& header);
+    void partData(int depth, const char* data, int size);
+    void partEnd(int depth);
+
+private:
+    QxtMailMessagePrivate* msg;
+    QByteArray body;
+    // receives the text of the current part: body, or content for an attachment
+    QByteArray* sink;
+    QByteArray delimiter;
+    QxtMailHeaders partHeaders;
+    QByteArray content;
+    QxtRfc2822Parser parser;
+    bool attachment;
+};
+
+#endif // MAILRFC2822PARSER_P_H
@@ -42,6 +42,7 @@
 #include <QStringList>
 #include <QTcpSocket>
 #include <QNetworkInterface>
+#include <QtConcurrent/QtConcurrentRun>
 #ifndef QT_NO_OPENSSL
 #    include <QSslSocket>
 #endif
@@ -49,6 +50,7 @@
 QxtSmtpPrivate::QxtSmtpPrivate(QxtSmtp *q)
     : QObject(0), q_ptr(q)
     , allowedAuthTypes(QxtSmtp::AuthPlain | QxtSmtp::AuthLogin | QxtSmtp::AuthCramMD5)
+    , renderAheadCount(0)
 {
     // empty ctor
 }
@@ -106,6 +108,8 @@ int QxtSmtp::send(const QxtMailMessage& message)
     d_func()->pending.append(qMakePair(messageID, message));
     if (d_func()->state == QxtSmtpPrivate::Waiting)
         d_func()->sendNext();
+    else
+        d_func()->renderAhead();
     return messageID;
 }
 
@@ -114,6 +118,31 @@ int QxtSmtp::pendingMessages() const
     return d_func()->pending.count();
 }
 
+/*!
+ * Returns the number of queued messages rendered in advance.
+ *
+ * \sa setRenderAheadCount()
+ */
+int QxtSmtp::renderAheadCount() const
+{
+    return d_func()->renderAheadCount;
+}
+
+/*!
+ * Renders the message being sent and the next \a count queued messages in the
+ * global QThreadPool, so that encoding overlaps with the SMTP dialog and the
+ * DATA payload is ready when the server accepts it. The default is \c 0, which
+ * renders each message in the event loop thread when it is sent.
+ *
+ * Attachment contents that aren't held in memory are read from the pool
+ * threads, so their devices must not be used elsewhere while they are queued.
+ */
+void QxtSmtp::setRenderAheadCount(int count)
+{
+    d_func()->renderAheadCount = qMax(0, count);
+    d_func()->renderAhead();
+}
+
 QTcpSocket* QxtSmtp::socket() const
 {
     return d_func()->socket;
@@ -533,6 +562,8 @@ void QxtSmtpPrivate::sendNext()
         return;
     }
 
+    renderAhead();
+
     if (pending.isEmpty())
     {
         // if there are no additional mails to send, finish up
@@ -651,7 +682,47 @@ void QxtSmtpPrivate::sendBody(const QByteArray& code, const QByteArray & line)
         return;
     }
 
-    socket->write(msg.rfc2822());
+    if (rendering.contains(messageID))
+    {
+        // rendered in the thread pool while the previous commands were sent
+        socket->write(rendering.take(messageID).result());
+    }
+    else
+    {
+        renderArena.reset();
+        msg.render(renderArena);
+        socket->write(renderArena.output);
+    }
     socket->write(".\r\n");
     state = BodySent;
 }
+
+static QByteArray qxt_render_message(const QxtMailMessage& message)
+{
+    // the result is also cached in the message shared with the caller of send()
+    return message.rfc2822();
+}
+
+void QxtSmtpPrivate::renderAhead()
+{
+    // message IDs grow along the queue: drop renderings of messages that left it
+    const int firstID = pending.isEmpty() ? nextID + 1 : pending.first().first;
+    QHash<int, QFuture<QByteArray> >::iterator i = rendering.begin();
+    while (i != rendering.end())
+    {
+        if (i.key() < firstID)
+            i = rendering.erase(i);
+        else
+            ++i;
+    }
+
+    if (renderAheadCount <= 0)
+        return;
+    const int count = qMin(pending.count(), renderAheadCount + 1);
+    for (int j = 0; j < count; j++)
+    {
+        const int messageID = pending.at(j).first;
+        if (!rendering.contains(messageID))
+            rendering.insert(messageID, QtConcurrent::run(qxt_render_message, pending.at(j).second));
+    }
+}
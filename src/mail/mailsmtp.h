@@ -84,6 +84,9 @@ public:
     int send(const QxtMailMessage& message);
     int pendingMessages() const;
 
+    int renderAheadCount() const;
+    void setRenderAheadCount(int count);
+
     QTcpSocket* socket() const;
     void connectToHost(const QString& hostName, quint16 port = 25);
     void connectToHost(const QHostAddress& address, quint16 port = 25);
@@ -33,10 +33,12 @@
 #define MAILSMTP_P_H
 
 #include "mailsmtp.h"
+#include "mailutility_p.h"
 #include <QHash>
 #include <QString>
 #include <QList>
 #include <QPair>
+#include <QFuture>
 
 class QxtSmtpPrivate : public QObject
 {
@@ -79,6 +81,11 @@ public:
     QStringList recipients;
     int nextID, rcptNumber, rcptAck;
     bool mailAck;
+    // reused for every message sent in this session
+    QxtMailRenderArena renderArena;
+    // messages being rendered in the thread pool, by message ID
+    QHash<int, QFuture<QByteArray> > rendering;
+    int renderAheadCount;
 
 #ifndef QT_NO_OPENSSL
     QSslSocket* socket;
@@ -96,6 +103,7 @@ public:
 
     void sendNextRcpt(const QByteArray& code, const QByteArray & line);
     void sendBody(const QByteArray& code, const QByteArray & line);
+    void renderAhead();
 
 public slots:
     void socketError(QAbstractSocket::SocketError err);
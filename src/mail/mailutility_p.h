@@ -33,9 +33,116 @@
 #define MAILUTILITY_P_H
 
 #include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <QVector>
 
-QByteArray qxt_fold_mime_header(const QString& key, const QString& value, QTextCodec* latin1,
-                                const QByteArray& prefix = QByteArray());
+struct QxtMailContentInfo
+{
+    QxtMailContentInfo()
+        : valid(false), size(0), eightBit(0), control(0), qpEscapes(0),
+          crlf(0), bareCr(0), bareLf(0), maxLineLength(0) {}
+
+    bool isAscii() const { return eightBit == 0 && control == 0; }
+
+    bool valid;
+    int size;
+    int eightBit;       // bytes with the high bit set
+    int control;        // control characters other than TAB, CR and LF
+    int qpEscapes;      // bytes quoted-printable has to escape
+    int crlf, bareCr, bareLf;
+    int maxLineLength;  // excluding the line break
+};
+
+enum QxtMailTransferEncoding
+{
+    QxtMail7Bit,
+    QxtMailQuotedPrintable,
+    QxtMailBase64
+};
+
+// Reusable buffers for rendering messages. Owners reset() the arena between
+// messages so that steady-state rendering doesn't go back to the allocator.
+class QxtMailRenderArena
+{
+public:
+    void reset();
+
+    QByteArray output;  // the rendered message
+    QByteArray bytes;   // UTF-8 form of the text being encoded
+    QString text;       // joined recipient lists
+};
+
+// Header fields kept in the order they were set, with names compared without
+// case and without lowercased copies. Well-known names are resolved once to a
+// small integer id, so that looking them up is an integer comparison.
+class QxtMailHeaders
+{
+public:
+    enum Id
+    {
+        Other,
+        From,
+        Sender,
+        ReplyTo,
+        To,
+        Cc,
+        Bcc,
+        Subject,
+        Date,
+        MessageId,
+        MimeVersion,
+        ContentType,
+        ContentTransferEncoding,
+        ContentDisposition,
+        IdCount
+    };
+
+    static int idOf(const QString& name);
+
+    bool isEmpty() const { return fields.isEmpty(); }
+    int count() const { return fields.count(); }
+    int id(int i) const { return fields.at(i).id; }
+    const QString& name(int i) const { return fields.at(i).name; }
+    const QString& value(int i) const { return fields.at(i).value; }
+
+    int indexOf(const QString& name) const;
+    int indexOf(Id id) const;
+    bool contains(const QString& name) const { return indexOf(name) != -1; }
+    bool contains(Id id) const { return indexOf(id) != -1; }
+    QString value(const QString& name) const;
+    QString value(Id id) const;
+
+    void set(const QString& name, const QString& value);
+    void remove(const QString& name);
+    void clear() { fields.clear(); }
+
+    QHash<QString, QString> toHash() const;
+    static QxtMailHeaders fromHash(const QHash<QString, QString>& hash);
+
+private:
+    struct Field
+    {
+        int id;
+        QString name;
+        QString value;
+    };
+
+    QVector<Field> fields;
+};
+
+void qxt_fold_mime_header(QByteArray& buffer, const QString& key, const QString& value,
+                          const QByteArray& prefix = QByteArray());
+
+QxtMailContentInfo qxt_analyze_content(const char* data, int size);
+QxtMailTransferEncoding qxt_choose_transfer_encoding(const QxtMailContentInfo& info, bool text);
+const char* qxt_transfer_encoding_name(QxtMailTransferEncoding encoding);
+void qxt_encode_7bit(QByteArray& buffer, const char* data, int size);
+void qxt_encode_quoted_printable(QByteArray& buffer, const char* data, int size);
+void qxt_encode_base64(QByteArray& buffer, const char* data, int size);
+void qxt_append_utf8(QByteArray& buffer, const QString& text);
+void qxt_append_latin1(QByteArray& buffer, const QString& text);
+QByteArray qxt_crlf_lines(const QByteArray& data);
 bool isTextMedia(const QString& contentType);
 
 #endif // MAILUTILITY_P_H
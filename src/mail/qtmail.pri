@@ -1,6 +1,6 @@
 INCLUDEPATH += $$PWD
 DEPENDEPATH += $$PWD
-QT += network
+QT += network concurrent
 
 !build_mail_lib:DEFINES += MAIL_NO_LIB
 
@@ -9,6 +9,12 @@ HEADERS += \
     $$PWD/mailutility_p.h \
     $$PWD/mailattachment.h \
     $$PWD/mailmessage.h \
+    $$PWD/mailmessage_p.h \
+    $$PWD/mailindex.h \
+    $$PWD/mailmaildir.h \
+    $$PWD/mailmbox.h \
+    $$PWD/mailmimepart.h \
+    $$PWD/mailrfc2822parser_p.h \
     $$PWD/mailsmtp.h \
     $$PWD/mailsmtp_p.h \
     $$PWD/mailglobal.h \
@@ -24,6 +30,11 @@ SOURCES += \
     $$PWD/mailhmac.cpp \
     $$PWD/mailattachment.cpp \
     $$PWD/mailmessage.cpp \
+    $$PWD/mailindex.cpp \
+    $$PWD/mailmaildir.cpp \
+    $$PWD/mailmbox.cpp \
+    $$PWD/mailmimepart.cpp \
+    $$PWD/mailrfc2822parser.cpp \
     $$PWD/mailsmtp.cpp \
     $$PWD/mailpop3.cpp \
     $$PWD/mailpop3reply.cpp
@@ -0,0 +1,170 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#ifndef QXTMAILBENCHMARK_H
+#define QXTMAILBENCHMARK_H
+
+// Helpers shared by the mail benchmarks. Each benchmark includes this header
+// from its only source file, which also gets the allocation counting hooks.
+
+#include <QByteArray>
+#include <QtGlobal>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+// heap allocations made by the calling thread between qxt_start_counting()
+// and qxt_stop_counting()
+static __thread bool qxt_counting = false;
+static __thread int qxt_allocations = 0;
+
+extern "C" void* malloc(size_t size) Q_DECL_NOTHROW
+{
+    if (qxt_counting)
+        qxt_allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) Q_DECL_NOTHROW
+{
+    if (qxt_counting)
+        qxt_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+static void qxt_start_counting()
+{
+    qxt_allocations = 0;
+    qxt_counting = true;
+}
+
+static int qxt_stop_counting()
+{
+    qxt_counting = false;
+    return qxt_allocations;
+}
+#endif
+
+// Pseudo-random numbers from a fixed seed, so that every run works on the same data.
+class QxtBenchRandom
+{
+public:
+    explicit QxtBenchRandom(quint32 seed) : state(seed) {}
+
+    quint32 next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+
+    int bounded(int n)
+    {
+        return int(next() % quint32(n));
+    }
+
+private:
+    quint32 state;
+};
+
+// ASCII words, then accented words in UTF-8, then a word starting a line with a dot
+static const char* const qxt_words[] =
+{
+    "account", "update", "meeting", "invoice", "release", "weekly", "report", "schedule", "review", "payment",
+    "order", "shipping", "notice", "welcome", "reminder", "project", "status", "digest", "offer", "summary",
+    "Gr\xc3\xbc\xc3\x9f" "e", "K\xc3\xb6ln", "caf\xc3\xa9", "se\xc3\xb1or", "na\xc3\xafve", "Z\xc3\xbcrich",
+    "fa\xc3\xa7" "ade", "d\xc3\xa9j\xc3\xa0",
+    ".hidden"
+};
+static const int QXT_ASCII_WORDS = 20;
+static const int QXT_ACCENTED_WORDS = 8;
+static const int QXT_ALL_WORDS = int(sizeof(qxt_words) / sizeof(qxt_words[0]));
+
+static const char* qxt_accented_word(QxtBenchRandom& random)
+{
+    return qxt_words[QXT_ASCII_WORDS + random.bounded(QXT_ACCENTED_WORDS)];
+}
+
+// about size bytes of text in lines of at most lineLength characters, ended by
+// lineBreak, with words from the first wordCount ones
+static QByteArray qxt_text(QxtBenchRandom& random, int size, int lineLength, int wordCount, const char* lineBreak = "\n")
+{
+    QByteArray rv;
+    rv.reserve(size + lineLength + 16);
+    int column = 0;
+    while (rv.size() < size)
+    {
+        const char* word = qxt_words[random.bounded(wordCount)];
+        const int length = int(qstrlen(word));
+        if (column + length + 1 > lineLength)
+        {
+            rv += lineBreak;
+            column = 0;
+        }
+        else if (column)
+        {
+            rv += ' ';
+            column++;
+        }
+        rv += word;
+        column += length;
+    }
+    rv += lineBreak;
+    return rv;
+}
+
+static QByteArray qxt_binary(QxtBenchRandom& random, int size)
+{
+    QByteArray rv(size, Qt::Uninitialized);
+    for (int i = 0; i < size; i++)
+        rv[i] = char(random.next());
+    return rv;
+}
+
+// Prints the rates over all the passes of a QBENCHMARK loop, which itself only
+// reports the time of one pass. messages is the number of messages handled by a
+// pass, if any, and allocations the allocations counted for one message, if any.
+static void qxt_report(qint64 nanoseconds, int passes, qint64 bytes, int messages, int allocations = -1)
+{
+    if (!passes || !bytes || nanoseconds <= 0)
+        return;
+    const double seconds = nanoseconds / 1e9;
+    QByteArray line = QByteArray::number(passes * bytes / seconds / (1024 * 1024), 'f', 1) + " MB/s, "
+                      + QByteArray::number(double(nanoseconds) / passes / bytes, 'f', 2) + " ns/byte";
+    if (messages > 0)
+        line += ", " + QByteArray::number(passes * messages / seconds, 'f', 0) + " messages/s";
+    if (allocations >= 0)
+        line += ", " + QByteArray::number(allocations) + " allocations per message";
+    qDebug("%s", line.constData());
+}
+
+#endif // QXTMAILBENCHMARK_H
@@ -0,0 +1,9 @@
+CONFIG += testcase benchmark
+TARGET = tst_bench_qxtmailparser
+QT = core testlib
+INCLUDEPATH += ..
+HEADERS += ../qxtmailbenchmark.h
+SOURCES += tst_bench_qxtmailparser.cpp
+
+# the sources are built into the benchmark, so that it can reach the private classes
+include(../../../src/mail/qtmail.pri)
@@ -0,0 +1,472 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#include <QtTest/QtTest>
+#include "mailmessage.h"
+#include "mailattachment.h"
+#include "mailrfc2822parser_p.h"
+#include "qxtmailbenchmark.h"
+
+static QByteArray qxt_words_text(QxtBenchRandom& random, int count)
+{
+    QByteArray rv;
+    for (int i = 0; i < count; i++)
+    {
+        if (i)
+            rv += ' ';
+        rv += qxt_words[random.bounded(QXT_ASCII_WORDS)];
+    }
+    return rv;
+}
+
+// about size bytes of ASCII text in CRLF lines of at most 72 characters
+static QByteArray qxt_paragraphs(QxtBenchRandom& random, int size)
+{
+    return qxt_text(random, size, 72, QXT_ASCII_WORDS, "\r\n");
+}
+
+static QByteArray qxt_base64_lines(const QByteArray& data)
+{
+    const QByteArray encoded = data.toBase64();
+    QByteArray rv;
+    rv.reserve(encoded.size() + encoded.size() / 38 + 2);
+    for (int i = 0; i < encoded.size(); i += 76)
+    {
+        rv += encoded.mid(i, 76);
+        rv += "\r\n";
+    }
+    return rv;
+}
+
+// an RFC 2047 encoded word holding utf8, in base64 or in quoted-printable
+static QByteArray qxt_encoded_word(QxtBenchRandom& random, const QByteArray& utf8)
+{
+    if (random.bounded(2))
+        return "=?UTF-8?B?" + utf8.toBase64() + "?=";
+    const QByteArray latin1 = QString::fromUtf8(utf8).toLatin1();
+    QByteArray rv = "=?ISO-8859-1?Q?";
+    for (int i = 0; i < latin1.size(); i++)
+    {
+        const uchar ch = latin1.at(i);
+        if (ch == ' ')
+            rv += '_';
+        else if (ch >= 0x80 || ch == '=' || ch == '?' || ch == '_')
+            rv += '=' + QByteArray::number(ch, 16).toUpper();
+        else
+            rv += char(ch);
+    }
+    return rv + "?=";
+}
+
+static QByteArray qxt_encoded_text(QxtBenchRandom& random, int count)
+{
+    QByteArray rv;
+    for (int i = 0; i < count; i++)
+    {
+        if (i)
+            rv += ' ';
+        QByteArray utf8 = qxt_accented_word(random);
+        utf8 += ' ';
+        utf8 += qxt_words[random.bounded(QXT_ASCII_WORDS)];
+        rv += qxt_encoded_word(random, utf8);
+    }
+    return rv;
+}
+
+static QByteArray qxt_envelope(QxtBenchRandom& random, int i, const QByteArray& subject)
+{
+    QByteArray rv;
+    rv += "From: Notifications <noreply@example.com>\r\n";
+    rv += "To: user" + QByteArray::number(i) + "@example.org\r\n";
+    rv += "Subject: " + subject + "\r\n";
+    rv += "Date: Mon, 5 Oct 2026 10:" + QByteArray::number(10 + random.bounded(50)) + ":00 +0000\r\n";
+    rv += "Message-ID: <" + QByteArray::number(i) + '.' + QByteArray::number(random.next()) + "@example.com>\r\n";
+    rv += "MIME-Version: 1.0\r\n";
+    return rv;
+}
+
+static QByteArray qxt_notification(QxtBenchRandom& random, int i)
+{
+    QByteArray rv = qxt_envelope(random, i, qxt_words_text(random, 5));
+    rv += "Content-Type: text/plain; charset=us-ascii\r\n\r\n";
+    rv += qxt_paragraphs(random, 300 + random.bounded(500));
+    return rv;
+}
+
+// a text part and about 1 MB of HTML in quoted-printable
+static QByteArray qxt_newsletter(QxtBenchRandom& random, int i)
+{
+    QByteArray rv = qxt_envelope(random, i, "Newsletter: " + qxt_words_text(random, 4));
+    rv += "Content-Type: multipart/alternative; boundary=\"news=_part\"\r\n\r\n";
+    rv += "--news=_part\r\nContent-Type: text/plain; charset=us-ascii\r\n\r\n";
+    rv += qxt_paragraphs(random, 16 * 1024);
+    rv += "--news=_part\r\nContent-Type: text/html; charset=utf-8\r\n"
+          "Content-Transfer-Encoding: quoted-printable\r\n\r\n";
+    const int start = rv.size();
+    while (rv.size() - start < 1024 * 1024)
+    {
+        rv += "<p class=3D\"item\"><a href=3D\"https://example.com/" + QByteArray::number(random.next()) + "\">=\r\n";
+        rv += qxt_words_text(random, 3) + "</a> " + qxt_words_text(random, 5) + "</p>\r\n";
+    }
+    rv += "--news=_part--\r\n";
+    return rv;
+}
+
+// a text part and 50 binary attachments of 1 to 8 KB
+static QByteArray qxt_attachments(QxtBenchRandom& random, int i)
+{
+    QByteArray rv = qxt_envelope(random, i, "Documents: " + qxt_words_text(random, 3));
+    rv += "Content-Type: multipart/mixed; boundary=\"files=_part\"\r\n\r\n";
+    rv += "--files=_part\r\nContent-Type: text/plain; charset=us-ascii\r\n\r\n";
+    rv += qxt_paragraphs(random, 1024);
+    for (int n = 0; n < 50; n++)
+    {
+        const QByteArray data = qxt_binary(random, 1024 + random.bounded(7 * 1024));
+        rv += "--files=_part\r\nContent-Type: application/octet-stream\r\nContent-Transfer-Encoding: base64\r\n";
+        rv += "Content-Disposition: attachment; filename=\"file" + QByteArray::number(n) + ".bin\"\r\n\r\n";
+        rv += qxt_base64_lines(data);
+    }
+    rv += "--files=_part--\r\n";
+    return rv;
+}
+
+// multiparts nested 24 levels deep, each level with a short text part
+static QByteArray qxt_nested(QxtBenchRandom& random, int i)
+{
+    static const int depth = 24;
+    QByteArray rv = qxt_envelope(random, i, "Re: " + qxt_words_text(random, 4));
+    rv += "Content-Type: multipart/mixed; boundary=\"nest00=_\"\r\n\r\n";
+    for (int level = 0; level < depth; level++)
+    {
+        const QByteArray boundary = "nest" + QByteArray::number(level).rightJustified(2, '0') + "=_";
+        rv += "--" + boundary + "\r\nContent-Type: text/plain; charset=us-ascii\r\n\r\n";
+        rv += qxt_paragraphs(random, 200);
+        if (level + 1 < depth)
+        {
+            rv += "--" + boundary + "\r\nContent-Type: multipart/mixed; boundary=\"nest"
+                  + QByteArray::number(level + 1).rightJustified(2, '0') + "=_\"\r\n\r\n";
+        }
+    }
+    for (int level = depth - 1; level >= 0; level--)
+        rv += "--nest" + QByteArray::number(level).rightJustified(2, '0') + "=_--\r\n";
+    return rv;
+}
+
+// encoded words in the subject, in 100 recipients and in 20 other fields
+static QByteArray qxt_encoded_headers(QxtBenchRandom& random, int i)
+{
+    QByteArray rv;
+    rv += "From: " + qxt_encoded_text(random, 2) + " <sender" + QByteArray::number(i) + "@example.com>\r\n";
+    rv += "To: ";
+    for (int n = 0; n < 100; n++)
+    {
+        if (n)
+            rv += ",\r\n ";
+        rv += qxt_encoded_text(random, 1) + " <rcpt" + QByteArray::number(n) + "@example.org>";
+    }
+    rv += "\r\nSubject: " + qxt_encoded_text(random, 8) + "\r\n";
+    for (int n = 0; n < 20; n++)
+        rv += "X-Label-" + QByteArray::number(n) + ": " + qxt_encoded_text(random, 3) + "\r\n";
+    rv += "Date: Mon, 5 Oct 2026 10:00:00 +0000\r\n";
+    rv += "Message-ID: <" + QByteArray::number(i) + ".encoded@example.com>\r\n";
+    rv += "MIME-Version: 1.0\r\nContent-Type: text/plain; charset=utf-8\r\n\r\n";
+    rv += qxt_paragraphs(random, 400);
+    return rv;
+}
+
+// Parsed attachments hold their content in a QBuffer that is deleted later; the
+// deferred deletes are run after each pass so that they don't pile up.
+static void qxt_delete_later_objects()
+{
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+}
+
+static const char* const qxt_kind_names[] =
+{
+    "notifications", "newsletters", "attachments", "nested", "encoded headers"
+};
+
+class tst_QxtMailParser : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Kind
+    {
+        Notifications,
+        Newsletters,
+        Attachments,
+        Nested,
+        EncodedHeaders,
+        KindCount
+    };
+
+    enum Parser
+    {
+        FullParse,
+        LazyParse,
+        PushParser,
+        ScanHeaders,
+        ParserCount
+    };
+
+private slots:
+    void initTestCase();
+
+    void parsers_data();
+    void parsers();
+
+    void fromRfc2822_data();
+    void fromRfc2822();
+    void headerAccess_data();
+    void headerAccess();
+    void attachmentExtraction_data();
+    void attachmentExtraction();
+    void parallelParse_data();
+    void parallelParse();
+
+private:
+    void addCorpusRows();
+
+    QList<QByteArray> corpus[KindCount];
+    qint64 corpusSize[KindCount];
+};
+
+void tst_QxtMailParser::initTestCase()
+{
+    static const int counts[KindCount] = { 2000, 4, 8, 200, 500 };
+    QxtBenchRandom random(20261018);
+    for (int kind = 0; kind < KindCount; kind++)
+    {
+        corpusSize[kind] = 0;
+        for (int i = 0; i < counts[kind]; i++)
+        {
+            QByteArray message;
+            switch (kind)
+            {
+            case Notifications:
+                message = qxt_notification(random, i);
+                break;
+            case Newsletters:
+                message = qxt_newsletter(random, i);
+                break;
+            case Attachments:
+                message = qxt_attachments(random, i);
+                break;
+            case Nested:
+                message = qxt_nested(random, i);
+                break;
+            default:
+                message = qxt_encoded_headers(random, i);
+                break;
+            }
+            corpusSize[kind] += message.size();
+            corpus[kind].append(message);
+        }
+    }
+}
+
+void tst_QxtMailParser::addCorpusRows()
+{
+    QTest::addColumn<int>("kind");
+    for (int kind = 0; kind < KindCount; kind++)
+        QTest::newRow(qxt_kind_names[kind]) << kind;
+}
+
+void tst_QxtMailParser::parsers_data()
+{
+    static const char* const names[ParserCount] = { "full", "lazy", "push", "scanHeaders" };
+    QTest::addColumn<int>("kind");
+    QTest::addColumn<int>("parser");
+    for (int kind = 0; kind < KindCount; kind++)
+    {
+        for (int parser = 0; parser < ParserCount; parser++)
+            QTest::newRow((QByteArray(qxt_kind_names[kind]) + " / " + names[parser]).constData()) << kind << parser;
+    }
+}
+
+// The ways a message can be read: parsed at once or lazily from a buffer,
+// built by the push parser from network-sized chunks as QxtPop3 does, or only
+// scanned for its header fields.
+void tst_QxtMailParser::parsers()
+{
+    QFETCH(int, kind);
+    QFETCH(int, parser);
+    const QList<QByteArray>& messages = corpus[kind];
+    const QStringList fields = QStringList() << QStringLiteral("from") << QStringLiteral("subject")
+                                             << QStringLiteral("date") << QStringLiteral("message-id");
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        foreach (const QByteArray& buffer, messages)
+        {
+            switch (parser)
+            {
+            case FullParse:
+                QxtMailMessage::fromRfc2822(buffer, QxtMailMessage::FullParse);
+                break;
+            case LazyParse:
+                QxtMailMessage::fromRfc2822(buffer, QxtMailMessage::LazyParse);
+                break;
+            case PushParser:
+            {
+                QxtMailMessageBuilder builder;
+                for (int pos = 0; pos < buffer.size(); pos += 1460)
+                    builder.feed(buffer.constData() + pos, qMin(1460, buffer.size() - pos));
+                builder.finish();
+                builder.message();
+                break;
+            }
+            default:
+                QxtMailMessage::scanHeaders(buffer, fields);
+                break;
+            }
+        }
+        qxt_delete_later_objects();
+        passes++;
+    }
+    qxt_report(timer.nsecsElapsed(), passes, corpusSize[kind], messages.count());
+}
+
+void tst_QxtMailParser::fromRfc2822_data()
+{
+    addCorpusRows();
+}
+
+void tst_QxtMailParser::fromRfc2822()
+{
+    QFETCH(int, kind);
+    const QList<QByteArray>& messages = corpus[kind];
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        foreach (const QByteArray& buffer, messages)
+            QxtMailMessage::fromRfc2822(buffer);
+        qxt_delete_later_objects();
+        passes++;
+    }
+    qxt_report(timer.nsecsElapsed(), passes, corpusSize[kind], messages.count());
+}
+
+void tst_QxtMailParser::headerAccess_data()
+{
+    addCorpusRows();
+}
+
+// the fields a mail client lists, read from messages parsed lazily
+void tst_QxtMailParser::headerAccess()
+{
+    QFETCH(int, kind);
+    const QList<QByteArray>& messages = corpus[kind];
+    int passes = 0;
+    int length = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        foreach (const QByteArray& buffer, messages)
+        {
+            const QxtMailMessage message = QxtMailMessage::fromRfc2822(buffer, QxtMailMessage::LazyParse);
+            length += message.sender().size() + message.subject().size() + message.recipients().count();
+            length += message.extraHeader(QStringLiteral("Date")).size();
+            length += message.extraHeader(QStringLiteral("Message-ID")).size();
+        }
+        passes++;
+    }
+    QVERIFY(length > 0);
+    qxt_report(timer.nsecsElapsed(), passes, corpusSize[kind], messages.count());
+}
+
+void tst_QxtMailParser::attachmentExtraction_data()
+{
+    addCorpusRows();
+}
+
+// decodes every attachment of messages parsed lazily
+void tst_QxtMailParser::attachmentExtraction()
+{
+    QFETCH(int, kind);
+    const QList<QByteArray>& messages = corpus[kind];
+    int passes = 0;
+    qint64 extracted = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        foreach (const QByteArray& buffer, messages)
+        {
+            const QxtMailMessage message = QxtMailMessage::fromRfc2822(buffer, QxtMailMessage::LazyParse);
+            const QHash<QString, QxtMailAttachment> attachments = message.attachments();
+            for (QHash<QString, QxtMailAttachment>::const_iterator i = attachments.constBegin(); i != attachments.constEnd(); ++i)
+                extracted += i.value().rawData().size();
+        }
+        qxt_delete_later_objects();
+        passes++;
+    }
+    if (kind == Attachments)
+        QVERIFY(extracted > 0);
+    qxt_report(timer.nsecsElapsed(), passes, corpusSize[kind], messages.count());
+}
+
+void tst_QxtMailParser::parallelParse_data()
+{
+    QTest::addColumn<int>("threads");
+    for (int threads = 1; threads <= 16; threads *= 2)
+        QTest::newRow(QByteArray::number(threads).constData()) << threads;
+}
+
+// Scaling of the batch fromRfc2822() with the number of threads, over the small
+// messages it hands out in batches. Messages with attachments are left out, as
+// their content buffers would be deleted by the threads of the pool.
+void tst_QxtMailParser::parallelParse()
+{
+    QFETCH(int, threads);
+    const QList<QByteArray> messages = corpus[Notifications] + corpus[EncodedHeaders];
+    const qint64 size = corpusSize[Notifications] + corpusSize[EncodedHeaders];
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        QCOMPARE(QxtMailMessage::fromRfc2822(messages, QxtMailMessage::FullParse, &pool).count(), messages.count());
+        passes++;
+    }
+    qxt_report(timer.nsecsElapsed(), passes, size, messages.count());
+}
+
+QTEST_MAIN(tst_QxtMailParser)
+#include "tst_bench_qxtmailparser.moc"
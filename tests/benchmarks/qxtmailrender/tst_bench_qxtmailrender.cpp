@@ -0,0 +1,306 @@
+/****************************************************************************
+** Copyright (c) 2006 - 2011, the LibQxt project <http://libqxt.org>
+** See the Qxt AUTHORS file for a list of authors and copyright holders.
+** Copyright (c) 2013 Debao Zhang <hello@debao.me>
+**
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the LibQxt project nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*****************************************************************************/
+
+#include <QtTest/QtTest>
+#include "mailmessage.h"
+#include "mailmessage_p.h"
+#include "mailattachment.h"
+#include "mailutility_p.h"
+#include "qxtmailbenchmark.h"
+
+// most heap allocations rendering a message into a warm arena may make
+static const int QXT_MAX_RENDER_ALLOCATIONS = 4;
+
+static QByteArray qxt_size_name(int size)
+{
+    return size >= 1024 * 1024 ? QByteArray::number(size / (1024 * 1024)) + " MB" : QByteArray::number(size / 1024) + " KB";
+}
+
+class tst_QxtMailRender : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Kind
+    {
+        AsciiWrap,
+        QuotedPrintable,
+        Base64,
+        MixedAttachments,
+        Recipients
+    };
+
+private slots:
+    void encodeBase64_data();
+    void encodeBase64();
+    void encodeQuotedPrintable_data();
+    void encodeQuotedPrintable();
+    void render_data();
+    void render();
+    void renderAllocations();
+    void attachmentCache_data();
+    void attachmentCache();
+
+private:
+    void addSizeRows();
+    QxtMailMessage buildMessage(int kind, int size);
+};
+
+void tst_QxtMailRender::addSizeRows()
+{
+    QTest::addColumn<int>("size");
+    static const int sizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+    for (int i = 0; i < 3; i++)
+        QTest::newRow(qxt_size_name(sizes[i]).constData()) << sizes[i];
+}
+
+void tst_QxtMailRender::encodeBase64_data()
+{
+    addSizeRows();
+}
+
+void tst_QxtMailRender::encodeBase64()
+{
+    QFETCH(int, size);
+    QxtBenchRandom random(1);
+    const QByteArray data = qxt_binary(random, size);
+    // a reserved capacity survives resize(0), so the passes don't allocate
+    QByteArray buffer;
+    buffer.reserve((size + 2) / 3 * 4 + 2 * (size / 57 + 1));
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        buffer.resize(0);
+        qxt_encode_base64(buffer, data.constData(), data.size());
+        passes++;
+    }
+    qxt_report(timer.nsecsElapsed(), passes, size, 0);
+}
+
+void tst_QxtMailRender::encodeQuotedPrintable_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("words");
+    static const int sizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+    for (int i = 0; i < 3; i++)
+    {
+        QTest::newRow((qxt_size_name(sizes[i]) + " ascii").constData()) << sizes[i] << QXT_ASCII_WORDS;
+        QTest::newRow((qxt_size_name(sizes[i]) + " latin").constData()) << sizes[i] << QXT_ALL_WORDS;
+    }
+}
+
+// long lines that need soft breaks, with or without bytes to escape
+void tst_QxtMailRender::encodeQuotedPrintable()
+{
+    QFETCH(int, size);
+    QFETCH(int, words);
+    QxtBenchRandom random(2);
+    const QByteArray data = qxt_text(random, size, 200, words);
+    QByteArray buffer;
+    buffer.reserve(3 * size + 3 * (size / 72 + 1));
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        buffer.resize(0);
+        qxt_encode_quoted_printable(buffer, data.constData(), data.size());
+        passes++;
+    }
+    qxt_report(timer.nsecsElapsed(), passes, size, 0);
+}
+
+QxtMailMessage tst_QxtMailRender::buildMessage(int kind, int size)
+{
+    QxtBenchRandom random(3);
+    QxtMailMessage rv(QStringLiteral("Sender <sender@example.com>"), QStringLiteral("rcpt@example.org"));
+    rv.setSubject(QStringLiteral("Quarterly report"));
+    switch (kind)
+    {
+    case AsciiWrap:
+        // paragraphs of a single line, wrapped when rendered
+        rv.setBody(QString::fromLatin1(qxt_text(random, size, 600, QXT_ASCII_WORDS)));
+        break;
+    case QuotedPrintable:
+        rv.setBody(QString::fromUtf8(qxt_text(random, size, 72, QXT_ALL_WORDS)));
+        rv.setExtraHeader(QStringLiteral("Content-Transfer-Encoding"), QStringLiteral("quoted-printable"));
+        break;
+    case Base64:
+        rv.setBody(QString::fromUtf8(qxt_text(random, size, 72, QXT_ALL_WORDS)));
+        rv.setExtraHeader(QStringLiteral("Content-Transfer-Encoding"), QStringLiteral("base64"));
+        break;
+    case MixedAttachments:
+        rv.setBody(QString::fromLatin1(qxt_text(random, 2048, 72, QXT_ASCII_WORDS)));
+        rv.addAttachment(QStringLiteral("report.pdf"), QxtMailAttachment(qxt_binary(random, size), QStringLiteral("application/pdf")));
+        rv.addAttachment(QStringLiteral("notes.txt"), QxtMailAttachment(qxt_text(random, size, 72, QXT_ALL_WORDS), QStringLiteral("text/plain")));
+        rv.addAttachment(QStringLiteral("logo.png"), QxtMailAttachment(qxt_binary(random, 8 * 1024), QStringLiteral("image/png")));
+        break;
+    default:
+        // 10000 recipients folded over as many lines
+        for (int i = 0; i < 10000; i++)
+            rv.addRecipient(QStringLiteral("Recipient %1 <rcpt%1@example.org>").arg(i), i % 4 ? QxtMailMessage::To : QxtMailMessage::Cc);
+        rv.setBody(QString::fromLatin1(qxt_text(random, 1024, 72, QXT_ASCII_WORDS)));
+        break;
+    }
+    return rv;
+}
+
+void tst_QxtMailRender::render_data()
+{
+    static const char* const names[] = { "ascii wrap", "quoted-printable", "base64", "mixed attachments" };
+    static const int sizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+    QTest::addColumn<int>("kind");
+    QTest::addColumn<int>("size");
+    for (int kind = AsciiWrap; kind <= MixedAttachments; kind++)
+    {
+        for (int i = 0; i < 3; i++)
+            QTest::newRow((QByteArray(names[kind]) + ' ' + qxt_size_name(sizes[i])).constData()) << kind << sizes[i];
+    }
+    QTest::newRow("10000 recipients") << int(Recipients) << 0;
+}
+
+// Renders a message into a reused arena, as QxtSmtp does. The private render
+// is called, as the public one would serve the output cached by the first pass.
+void tst_QxtMailRender::render()
+{
+    QFETCH(int, kind);
+    QFETCH(int, size);
+    const QxtMailMessage message = buildMessage(kind, size);
+    const QxtMailMessagePrivate* d = QxtMailMessagePrivate::get(message);
+    QxtMailRenderArena arena;
+    // the first render grows the arena and fills the encoded attachment cache
+    d->render(arena);
+    const qint64 bytes = arena.output.size();
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        arena.reset();
+        d->render(arena);
+        passes++;
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+    int allocations = -1;
+#if defined(__GLIBC__)
+    arena.reset();
+    qxt_start_counting();
+    d->render(arena);
+    allocations = qxt_stop_counting();
+#endif
+    QCOMPARE(arena.output.size(), int(bytes));
+    qxt_report(elapsed, passes, bytes, 1, allocations);
+}
+
+// Rendering into an arena reused from one message to the next, as QxtSmtp does,
+// must make only a few allocations per message once the arena has grown: the
+// copy kept as the render cache, and little else. A setter drops the cached
+// output of each message before every pass, so that every pass renders again.
+void tst_QxtMailRender::renderAllocations()
+{
+#if defined(__GLIBC__)
+    QxtBenchRandom random(5);
+    const QString body = QString::fromLatin1(qxt_text(random, 64 * 1024, 72, QXT_ASCII_WORDS));
+    const QString subject = QStringLiteral("Quarterly report");
+    QList<QxtMailMessage> messages;
+    for (int i = 0; i < 25; i++)
+    {
+        QxtMailMessage message(QStringLiteral("sender@example.com"), QStringLiteral("rcpt%1@example.org").arg(i));
+        message.setSubject(subject);
+        message.setBody(body);
+        messages.append(message);
+    }
+
+    QxtMailRenderArena arena;
+    int most = 0;
+    for (int pass = 0; pass < 3; pass++)
+    {
+        for (int i = 0; i < messages.count(); i++)
+        {
+            QxtMailMessage& message = messages[i];
+            message.setSubject(subject);
+            arena.reset();
+            qxt_start_counting();
+            QxtMailMessagePrivate::renderMessage(message, arena);
+            const int allocations = qxt_stop_counting();
+            QVERIFY(!arena.output.isEmpty());
+            // the first pass grows the buffers of the arena
+            if (pass > 0)
+                most = qMax(most, allocations);
+        }
+    }
+    qDebug("%d messages of 64 KB: at most %d allocations per message", messages.count(), most);
+    QVERIFY2(most <= QXT_MAX_RENDER_ALLOCATIONS, QByteArray::number(most).constData());
+#else
+    QSKIP("Allocations are only counted with glibc");
+#endif
+}
+
+void tst_QxtMailRender::attachmentCache_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("cached");
+    static const int sizes[] = { 64 * 1024, 1024 * 1024 };
+    for (int i = 0; i < 2; i++)
+    {
+        QTest::newRow((qxt_size_name(sizes[i]) + " hit").constData()) << sizes[i] << true;
+        QTest::newRow((qxt_size_name(sizes[i]) + " uncached").constData()) << sizes[i] << false;
+    }
+}
+
+// The same document attached to many messages: encoded once and then copied
+// from the shared cache, compared with encoding it every time.
+void tst_QxtMailRender::attachmentCache()
+{
+    QFETCH(int, size);
+    QFETCH(bool, cached);
+    QxtBenchRandom random(4);
+    QxtMailAttachment attachment(qxt_binary(random, size), QStringLiteral("application/pdf"));
+    const int cacheSize = QxtMailAttachment::encodedCacheSize();
+    if (!cached)
+        QxtMailAttachment::setEncodedCacheSize(0);
+    const qint64 bytes = attachment.mimeData().size();
+    int passes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK
+    {
+        attachment.mimeData();
+        passes++;
+    }
+    QxtMailAttachment::setEncodedCacheSize(cacheSize);
+    qxt_report(timer.nsecsElapsed(), passes, bytes, 1);
+}
+
+QTEST_MAIN(tst_QxtMailRender)
+#include "tst_bench_qxtmailrender.moc"